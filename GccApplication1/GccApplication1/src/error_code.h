@@ -44,7 +44,7 @@ ERR_RUN_1_USER_CALLED_OS_ABORT,
 /** Too many tasks created. Only allowed MAXPROCESS at any time.*/
 ERR_RUN_2_TOO_MANY_TASKS,
 
-/** PERIODIC task still running at end of time slot. */
+/** PERIODIC job ran longer than its WCET. */
 ERR_RUN_3_PERIODIC_TOOK_TOO_LONG,
 
 /** ISR made a request that only tasks are allowed. */
@@ -59,6 +59,15 @@ ERR_RUN_6_PERIODIC_CONFLICT,
 /** too many periodic tasks */
 ERR_RUN_7_PERIODIC_TOO_MANY,
 
+/** PERIODIC task tried to sleep or wait */
+ERR_RUN_8_PERIODIC_WAIT,
+
+/** an ISR made more requests than the ISR request queue holds before the kernel could run */
+ERR_RUN_9_ISR_QUEUE_FULL,
+
+/** a plain value used on a payload service or the reverse, or a pointer that is not a payload block */
+ERR_RUN_10_PAYLOAD_MISUSE,
+
 };
 
 
@@ -32,6 +32,31 @@ extern "C" {
 /** The number of clock cycles in one "tick" or 5 ms */
 #define TICK_CYCLES     (((F_CPU / TIMER_PRESCALER) / 1000) * TICK)
 
+/**
+ * Define TICKLESS to program Timer 1 for the next scheduling event
+ * (periodic release, sleep timeout or RR quantum end) instead of every TICK.
+ */
+/* #define TICKLESS */
+
+/** The furthest ahead the tickless timer is programmed, bounded by the 16 bit Timer 1. */
+#define TICKLESS_MAX_TICKS  ((uint16_t)(0xFFFFUL / TICK_CYCLES))
+
+/** Timer 1 cycles left for the kernel to exit when a tickless event is already due. */
+#define TICKLESS_MIN_CYCLES 64
+
+/** Longest stretch of a PERIODIC job's budget OCR1B times at once, in Timer 1 cycles.
+ *  Longer budgets are timed in pieces, each well inside the 16 bit timer's range. */
+#define BUDGET_CHUNK        0x8000U
+
+/** Shortest stretch OCR1B is armed for, so the compare cannot be missed while arming. */
+#define BUDGET_MIN_CYCLES   4
+
+/** Timer 1 cycles ahead OCR1C is armed for the soft interrupt that drains ISR requests. */
+#define ISR_SOFT_IRQ_CYCLES 2
+
+/** Requests ISRs can queue for the kernel, a power of two at most 128. */
+#define ISR_QUEUE_SIZE      16
+
 /** LEDs for OS_Abort() */
 #define ERROR_LED       (uint8_t)(_BV(PB7) | _BV(PB7))
 
@@ -63,11 +88,54 @@ typedef enum
     TASK_TERMINATE,
     TASK_NEXT,
     TASK_GET_ARG,
-	TASK_INTERRUPT,
+	TASK_SLEEP,
+	SERVICE_SUBSCRIBE,
+	SERVICE_PUBLISH,
+	ISR_REQUEST,
+	TASK_NOTIFY,
+	TASK_NOTIFY_WAIT,
+	SEMAPHORE_TAKE,
+	SEMAPHORE_GIVE,
+	EVENT_WAIT,
+	EVENT_SET,
+	POOL_ALLOC,
+	POOL_FREE,
 }
 kernel_request_t;
 
 
+/**
+ * @brief The operations an ISR can ask of the kernel through the ISR request queue.
+ */
+typedef enum
+{
+	ISR_PUBLISH = 0,
+	ISR_CREATE,
+	ISR_NOTIFY,
+	ISR_SEMAPHORE_GIVE,
+	ISR_EVENT_SET,
+	ISR_POOL_FREE,
+}
+isr_request_type_t;
+
+
+/**
+ * @brief An operation queued by an ISR, carried out on the next kernel entry.
+ */
+typedef struct
+{
+	/** An isr_request_type_t. */
+	uint8_t type;
+	/** Level of the task to create. */
+	uint8_t level;
+	/** The value to publish, the new task's argument, or the block freed. */
+	int16_t value;
+	/** The SERVICE, SEMAPHORE, EVENT_GROUP or POOL, the new task's function, or the task notified. */
+	void* object;
+}
+isr_request_t;
+
+
 /**
  * @brief The arguments required to create a task.
  */
@@ -89,6 +157,10 @@ typedef struct
 create_args_t;
 
 
+#if MAXSERVICE > 8
+#error "MAXSERVICE must be at most 8, one bit per service in td_struct.subscribed"
+#endif
+
 typedef struct td_struct task_descriptor_t;
 /**
  * @brief All the data needed to describe the task, including its context.
@@ -109,27 +181,48 @@ struct td_struct
     uint8_t                         level;
     /** A link to the next task descriptor in the queue holding this task. */
     task_descriptor_t*              next;
+    /** A link to the previous task descriptor in the queue holding this task, so it can be removed in O(1). */
+    task_descriptor_t*              prev;
 	/**For use with SERVICE, the saved value from the publish**/
 	int16_t*						value;
+	/** Bit i is set once the task has subscribed to queued service i. */
+	uint8_t							subscribed;
+	/** Sequence number of the next value the task reads from each queued service. */
+	uint16_t						cursor[MAXSERVICE];
+	/** Notification word, see Task_Notify(). */
+	uint16_t						notify;
+	/** Bits of notify the task waits for in Task_NotifyWait(), 0 when not waiting. */
+	uint16_t						notify_mask;
+	/** Flags waited for in Event_Group_Wait(); the group's flags once woken. */
+	uint16_t						wait_bits;
+	/** Mode of the Event_Group_Wait(). */
+	uint8_t							wait_mode;
+	/** The block Pool_Free() handed to the task waiting in Pool_Alloc(). */
+	void*							block;
 	uint16_t period;
 	uint16_t wcet;
 	uint16_t start;
-	uint16_t time_remaining;
-	uint16_t wcet_remaining;
+	/** Execution time the current job has left, in Timer 1 cycles. */
+	uint32_t budget;
+	/** Ticks after the previous task in the delta list holding this task. */
+	uint16_t						delta;
+	/** A link to the next task descriptor in the delta list holding this task. */
+	task_descriptor_t*				delta_next;
+	/** A link to the previous task descriptor in the delta list, NULL at its head. */
+	task_descriptor_t*				delta_prev;
+	/** The service the task waits on in Service_Subscribe_Timeout(), NULL otherwise. */
+	SERVICE*						service;
+	/** Set when the task's last Service_Subscribe_Timeout() timed out. */
+	uint8_t							timed_out;
 };
 
 
 /**
  * @brief Contains pointers to head and tail of a linked list.
+ *
+ * It is the task_queue of os.h, which pools embed in their public descriptor.
  */
-typedef struct
-{
-    /** The first item in the queue. NULL if the queue is empty. */
-    task_descriptor_t*  head;
-    /** The last item in the queue. Undefined if the queue is empty. */
-    task_descriptor_t*  tail;
-}
-queue_t;
+typedef struct task_queue queue_t;
 
 #ifdef __cplusplus
 }
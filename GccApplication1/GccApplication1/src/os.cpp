@@ -50,6 +50,39 @@ static volatile create_args_t kernel_request_create_args;
 /** Return value for Task_Create() request. */
 static volatile int kernel_request_retval;
 
+/** Argument for Task_Sleep() request, in ticks from now. */
+static volatile uint16_t kernel_request_ticks;
+
+/** Service for Service_Subscribe() and Service_Publish() requests. */
+static SERVICE* volatile kernel_request_service;
+
+/** Value for Service_Publish() request. */
+static volatile int16_t kernel_request_value;
+
+/** Task for Task_Notify() request. */
+static task_descriptor_t* volatile kernel_request_task;
+
+/** Semaphore for Semaphore_Take() and Semaphore_Give() requests. */
+static SEMAPHORE* volatile kernel_request_semaphore;
+
+/** Event group for Event_Group_Wait() and Event_Group_Set() requests. */
+static EVENT_GROUP* volatile kernel_request_group;
+
+/** Pool for Pool_Alloc() and Pool_Free() requests. */
+static POOL* volatile kernel_request_pool;
+
+/** Block for Pool_Free() request. */
+static void* volatile kernel_request_block;
+
+#if ISR_QUEUE_SIZE & (ISR_QUEUE_SIZE - 1) || ISR_QUEUE_SIZE > 128
+#error "ISR_QUEUE_SIZE must be a power of two, at most 128"
+#endif
+
+/** Requests queued by ISRs. Only ISRs write isr_head, only the kernel writes isr_tail. */
+static isr_request_t isr_queue[ISR_QUEUE_SIZE];
+static volatile uint8_t isr_head = 0;
+static volatile uint8_t isr_tail = 0;
+
 /** Number of tasks created so far */
 static queue_t dead_pool_queue;
 
@@ -72,14 +105,25 @@ static volatile uint8_t ticks_remaining = 0;
 /** The task descriptor for index "name of task" */
 //static task_descriptor_t* name_to_task_ptr[MAXNAME + 1];
 
-/** The task descriptors for tasks in PPP */
-static task_descriptor_t* task_in_PPP[MAXPROCESS];
+/** PERIODIC tasks waiting for their next release, sorted by release time.
+ *  Each delta counts ticks after the previous entry; the head's counts from timer_time. */
+static task_descriptor_t* release_list = NULL;
+
+/** SYSTEM and RR tasks in Task_Sleep(), a delta list like release_list. */
+static task_descriptor_t* sleep_list = NULL;
 
 /** Error message used in OS_Abort() */
 static uint8_t volatile error_msg = ERR_RUN_1_USER_CALLED_OS_ABORT;
 
+/** Timer 1 count up to which the running PERIODIC task's budget has been charged. */
+static uint16_t volatile budget_since;
+
+/** Set while OCR1B is timing the running PERIODIC task's budget. */
+static uint8_t budget_armed = 0;
+
 /**running time */
 static uint16_t volatile running_time = 0;
+/** TCNT1 at the last tick boundary counted in running_time */
 static uint16_t volatile timer_time = 0;
 /* Forward declarations */
 /* kernel */
@@ -90,6 +134,9 @@ static void kernel_handle_request(void);
 static void exit_kernel(void) __attribute((noinline, naked));
 static void enter_kernel(void) __attribute((noinline, naked));
 extern "C" void TIMER1_COMPA_vect(void) __attribute__ ((signal, naked));
+extern "C" void TIMER1_COMPC_vect(void) __attribute__ ((signal, naked));
+static void kernel_arm_budget(void);
+static void kernel_charge_budget(void);
 
 static int kernel_create_task();
 static void kernel_terminate_task(void);
@@ -97,8 +144,35 @@ static void kernel_terminate_task(void);
 
 static void enqueue(queue_t* queue_ptr, task_descriptor_t* task_to_add);
 static task_descriptor_t* dequeue(queue_t* queue_ptr);
+static void queue_remove(queue_t* queue_ptr, task_descriptor_t* task_to_remove);
+static void delta_insert(task_descriptor_t** list_ptr, task_descriptor_t* task_to_add, uint16_t ticks);
+static void delta_remove(task_descriptor_t** list_ptr, task_descriptor_t* task_to_remove);
 
 static void kernel_update_ticker(void);
+static int kernel_admit_periodic(void);
+static uint16_t gcd(uint16_t a, uint16_t b);
+static uint16_t kernel_ticks_pending(void);
+static void kernel_wake_task(task_descriptor_t* p);
+static void kernel_preempt(void);
+static void kernel_service_publish(SERVICE* s, int16_t v);
+static void kernel_drain_isr_requests(void);
+static void kernel_notify_wake(task_descriptor_t* p);
+static void kernel_semaphore_give(SEMAPHORE* s);
+static void kernel_event_check(EVENT_GROUP* g);
+static void kernel_pool_free(POOL* p, void* block);
+static void pool_setup(POOL* p);
+static void* pool_take(POOL* p);
+static void pool_put(POOL* p, void* block);
+static void service_take(SERVICE* s, task_descriptor_t* p);
+static void payload_drop(uint8_t i);
+static void service_publish(SERVICE* s, int16_t v, uint8_t sreg);
+static int8_t service_subscribe(SERVICE* s, int16_t* v, uint16_t ticks);
+static uint8_t payload_index(void* block);
+static uint8_t isr_request(uint8_t type, uint8_t level, int16_t value, void* object);
+static void kernel_program_timer(void);
+#ifdef TICKLESS
+static uint16_t kernel_next_event(void);
+#endif
 //static void check_PPP_names(void);
 static void idle (void);
 static void _delay_25ms(void);
@@ -109,13 +183,54 @@ struct service {
 	int16_t value;
 	uint16_t waiting;
 	queue_t task_list;
+	/** Ring of the last values published to a queued service, NULL for a plain one. */
+	int16_t* ring;
+	/** Ring size minus one; the size is a power of two. */
+	uint8_t mask;
+	/** Sequence number of the next value to be published. */
+	uint16_t head;
+	/** Non-zero for a payload service; value is then the index of a payload block. */
+	uint8_t payload;
 };
 
 static SERVICE services[MAXSERVICE];
 static uint16_t service_cntr = 0;
 
+struct semaphore {
+	int16_t count;
+	/** Waiting SYSTEM tasks, then waiting RR tasks. */
+	queue_t waiters[2];
+};
+
+static SEMAPHORE semaphores[MAXSEMAPHORE];
+static uint8_t semaphore_cntr = 0;
+
+struct event_group {
+	uint16_t flags;
+	/** Union of the flags the waiting tasks wait for; setting others needs no kernel entry. */
+	uint16_t wanted;
+	queue_t waiters;
+};
+
+static EVENT_GROUP event_groups[MAXEVENTGROUP];
+static uint8_t event_group_cntr = 0;
+
+/** Storage the rings of queued services are carved from. */
+static int16_t service_ring_pool[SERVICE_RING_POOL];
+static uint16_t service_ring_used = 0;
+
+/** The payload blocks, and the kernel pool they are handed out from. */
+static uint8_t payload_pool[PAYLOAD_BLOCKS][POOL_BLOCK_SIZE(PAYLOAD_SIZE)];
+static POOL payload_blocks = { payload_pool[0], sizeof(payload_pool[0]), PAYLOAD_BLOCKS };
+
+/** References held to each block: one by its owner, or one per subscriber it was delivered to. */
+static uint8_t payload_refs[PAYLOAD_BLOCKS];
+
 static uint16_t ppp_tasks_len = 0;
 
+/** Sum of wcet/period of the admitted PERIODIC tasks, 1024 is the whole processor. */
+static uint16_t periodic_utilization = 0;
+
 
 /*
 * FUNCTIONS
@@ -151,12 +266,23 @@ static void kernel_main_loop(void)
 	{
 		kernel_dispatch();
 		
+		kernel_program_timer();
+		
+		kernel_arm_budget();
+		
 		exit_kernel();
 		
 		/* if this task makes a system call, or is interrupted,
 		* the thread of control will return to here. */
 		
+		kernel_charge_budget();
+		
 		kernel_handle_request();
+		
+		if(isr_tail != isr_head)
+		{
+			kernel_drain_isr_requests();
+		}
 	}
 }
 
@@ -280,8 +406,8 @@ static void kernel_handle_request(void)
 			break;
 			
 		case PERIODIC:
+			/* Already in release_list for its next period. */
 			cur_task->state = WAITING;
-			cur_task->time_remaining = 0;
 			break;
 			
 		case RR:
@@ -295,6 +421,107 @@ static void kernel_handle_request(void)
 		cur_task->state = READY;
 		break;
 		
+	case TASK_SLEEP:
+		if(cur_task->level == PERIODIC)
+		{
+			error_msg = ERR_RUN_8_PERIODIC_WAIT;
+			OS_Abort();
+		}
+		
+		/* sleep_list counts from timer_time, which may lag the current tick. */
+		cur_task->state = WAITING;
+		delta_insert(&sleep_list, cur_task, kernel_request_ticks + kernel_ticks_pending());
+		break;
+		
+	case SERVICE_SUBSCRIBE:
+		if(cur_task->level == PERIODIC)
+		{
+			error_msg = ERR_RUN_8_PERIODIC_WAIT;
+			OS_Abort();
+		}
+		
+		cur_task->state = WAITING;
+		enqueue(&kernel_request_service->task_list, cur_task);
+		kernel_request_service->waiting++;
+		if(kernel_request_ticks != SERVICE_FOREVER)
+		{
+			cur_task->service = kernel_request_service;
+			delta_insert(&sleep_list, cur_task, kernel_request_ticks + kernel_ticks_pending());
+		}
+		break;
+		
+	case SERVICE_PUBLISH:
+		kernel_service_publish(kernel_request_service, kernel_request_value);
+		break;
+		
+	case TASK_NOTIFY:
+		kernel_notify_wake(kernel_request_task);
+		break;
+		
+	case TASK_NOTIFY_WAIT:
+		if(cur_task->level == PERIODIC)
+		{
+			error_msg = ERR_RUN_8_PERIODIC_WAIT;
+			OS_Abort();
+		}
+		
+		cur_task->state = WAITING;
+		if(kernel_request_ticks != NOTIFY_FOREVER)
+		{
+			delta_insert(&sleep_list, cur_task, kernel_request_ticks + kernel_ticks_pending());
+		}
+		break;
+		
+	case SEMAPHORE_TAKE:
+		if(cur_task->level == PERIODIC)
+		{
+			error_msg = ERR_RUN_8_PERIODIC_WAIT;
+			OS_Abort();
+		}
+		
+		cur_task->state = WAITING;
+		enqueue(&kernel_request_semaphore->waiters[cur_task->level == SYSTEM ? 0 : 1], cur_task);
+		break;
+		
+	case SEMAPHORE_GIVE:
+		kernel_semaphore_give(kernel_request_semaphore);
+		break;
+		
+	case EVENT_WAIT:
+		if(cur_task->level == PERIODIC)
+		{
+			error_msg = ERR_RUN_8_PERIODIC_WAIT;
+			OS_Abort();
+		}
+		
+		cur_task->state = WAITING;
+		enqueue(&kernel_request_group->waiters, cur_task);
+		kernel_request_group->wanted |= cur_task->wait_bits;
+		break;
+		
+	case EVENT_SET:
+		kernel_event_check(kernel_request_group);
+		break;
+		
+	case POOL_ALLOC:
+		if(cur_task->level == PERIODIC)
+		{
+			error_msg = ERR_RUN_8_PERIODIC_WAIT;
+			OS_Abort();
+		}
+		
+		cur_task->state = WAITING;
+		enqueue(&kernel_request_pool->waiters[cur_task->level == SYSTEM ? 0 : 1], cur_task);
+		break;
+		
+	case POOL_FREE:
+		kernel_pool_free(kernel_request_pool, kernel_request_block);
+		break;
+		
+	case ISR_REQUEST:
+		/* Drained by the main loop; the interrupted task keeps running unless a wake-up pre-empts it. */
+		break;
+		
 	case TASK_GET_ARG:
 		/* Should not happen. Handled in task itself. */
 		break;
@@ -580,6 +807,34 @@ void TIMER1_COMPA_vect(void)
 }
 
 
+/**
+* @fn TIMER1_COMPC_vect
+*
+* @brief The soft interrupt raised by isr_request().
+*
+* Taken right after the ISR that queued a request returns. Enters the kernel
+* exactly like TIMER1_COMPA_vect, which then drains the ISR request queue.
+*/
+void TIMER1_COMPC_vect(void)
+{
+	SAVE_CTX_TOP();
+	
+	STACK_SREG_SET_I_BIT();
+	
+	SAVE_CTX_BOTTOM();
+	
+	cur_task->sp = (uint8_t*)SP;
+	
+	SP = kernel_sp;
+	
+	kernel_request = ISR_REQUEST;
+	
+	RESTORE_CTX();
+	
+	asm volatile ("ret\n"::);
+}
+
+
 /*
 * Tasks Functions
 */
@@ -604,6 +859,12 @@ static int kernel_create_task()
 		return 0;
 	}
 	
+	if(kernel_request_create_args.level == PERIODIC && !kernel_admit_periodic())
+	{
+		/* Would overlap an admitted PERIODIC task, sooner or later. */
+		return 0;
+	}
+	
 	
 	/* idling "task" goes in last descriptor. */
 	if(kernel_request_create_args.level == NULL)
@@ -666,11 +927,14 @@ static int kernel_create_task()
 	p->arg = kernel_request_create_args.arg;
 	p->level = kernel_request_create_args.level;
 	p->name = kernel_request_create_args.name;
+	p->subscribed = 0;
+	p->notify = 0;
+	p->notify_mask = 0;
+	p->service = NULL;
 	p->period = kernel_request_create_args.period;
 	p->wcet = kernel_request_create_args.wcet;
 	p->start = kernel_request_create_args.start; //when to start the periodic task
-	p->time_remaining = p->start - running_time;
-	p->wcet_remaining = p->wcet;
+	p->budget = (uint32_t)p->wcet * TICK_CYCLES;
 	
 	switch(kernel_request_create_args.level)
 	{
@@ -679,8 +943,13 @@ static int kernel_create_task()
 		//name_to_task_ptr[kernel_request_create_args.name] = p;
 		
 		if(ppp_tasks_len < MAXPROCESS - 1){
-			task_in_PPP[ppp_tasks_len] = p;
+			/* First release at "start", or on the next tick if that is already past.
+			 * A delta of 0 would also release it on the next tick, but count its
+			 * later releases from the current one, a tick earlier than admitted. */
+			delta_insert(&release_list, p,
+				(int16_t)(p->start - running_time) > 0 ? p->start - running_time : 1);
 			ppp_tasks_len++;
+			periodic_utilization += (uint16_t)(((uint32_t)p->wcet << 10) / p->period);
 		}else{
 			//too many
 			error_msg = ERR_RUN_7_PERIODIC_TOO_MANY;
@@ -719,12 +988,9 @@ static void kernel_terminate_task(void)
 	if(cur_task->level == PERIODIC)
 	{
 		//name_to_task_ptr[cur_task->name] = NULL;
-		for(int i=0; i < MAXPROCESS; i++){
-			if(cur_task == task_in_PPP[i]){
-				PORTB = (uint8_t)(_BV(PB7));
-				task_in_PPP[i] = NULL;
-			}
-		}
+		delta_remove(&release_list, cur_task);
+		ppp_tasks_len--;
+		periodic_utilization -= (uint16_t)(((uint32_t)cur_task->wcet << 10) / cur_task->period);
 		
 	}
 	enqueue(&dead_pool_queue, cur_task);
@@ -743,6 +1009,7 @@ static void kernel_terminate_task(void)
 static void enqueue(queue_t* queue_ptr, task_descriptor_t* task_to_add)
 {
 	task_to_add->next = NULL;
+	task_to_add->prev = queue_ptr->tail;
 	
 	if(queue_ptr->head == NULL)
 	{
@@ -772,6 +1039,14 @@ static task_descriptor_t* dequeue(queue_t* queue_ptr)
 	if(queue_ptr->head != NULL)
 	{
 		queue_ptr->head = queue_ptr->head->next;
+		if(queue_ptr->head != NULL)
+		{
+			queue_ptr->head->prev = NULL;
+		}
+		else
+		{
+			queue_ptr->tail = NULL;
+		}
 		task_ptr->next = NULL;
 	}
 	
@@ -779,6 +1054,114 @@ static task_descriptor_t* dequeue(queue_t* queue_ptr)
 }
 
 
+/**
+* @brief Unlink a task from anywhere in a queue, in O(1).
+*
+* @param queue_ptr the queue holding the task
+* @param task_to_remove the task descriptor to remove
+*/
+static void queue_remove(queue_t* queue_ptr, task_descriptor_t* task_to_remove)
+{
+	if(task_to_remove->prev != NULL)
+	{
+		task_to_remove->prev->next = task_to_remove->next;
+	}
+	else
+	{
+		queue_ptr->head = task_to_remove->next;
+	}
+	
+	if(task_to_remove->next != NULL)
+	{
+		task_to_remove->next->prev = task_to_remove->prev;
+	}
+	else
+	{
+		queue_ptr->tail = task_to_remove->prev;
+	}
+	
+	task_to_remove->next = NULL;
+	task_to_remove->prev = NULL;
+}
+
+
+/**
+* @brief Insert a task in a delta list, after every task due at the same time.
+*
+* @param list_ptr the delta list to insert in
+* @param task_to_add the task descriptor to add
+* @param ticks ticks from the list's reference time until the task is due
+*/
+static void delta_insert(task_descriptor_t** list_ptr, task_descriptor_t* task_to_add, uint16_t ticks)
+{
+	task_descriptor_t* prev = NULL;
+	task_descriptor_t* next = *list_ptr;
+	
+	while(next != NULL && next->delta <= ticks)
+	{
+		ticks -= next->delta;
+		prev = next;
+		next = next->delta_next;
+	}
+	
+	task_to_add->delta = ticks;
+	task_to_add->delta_next = next;
+	task_to_add->delta_prev = prev;
+	
+	/* The task after the new one is now due relative to it. */
+	if(next != NULL)
+	{
+		next->delta -= ticks;
+		next->delta_prev = task_to_add;
+	}
+	
+	if(prev != NULL)
+	{
+		prev->delta_next = task_to_add;
+	}
+	else
+	{
+		*list_ptr = task_to_add;
+	}
+}
+
+
+/**
+* @brief Unlink a task from a delta list, if it is in it, in O(1).
+*
+* @param list_ptr the delta list to remove from
+* @param task_to_remove the task descriptor to remove
+*/
+static void delta_remove(task_descriptor_t** list_ptr, task_descriptor_t* task_to_remove)
+{
+	task_descriptor_t* next = task_to_remove->delta_next;
+	
+	/* Only the head of a list has no previous task. */
+	if(task_to_remove->delta_prev == NULL && *list_ptr != task_to_remove)
+	{
+		return;
+	}
+	
+	if(next != NULL)
+	{
+		next->delta += task_to_remove->delta;
+		next->delta_prev = task_to_remove->delta_prev;
+	}
+	
+	if(task_to_remove->delta_prev != NULL)
+	{
+		task_to_remove->delta_prev->delta_next = next;
+	}
+	else
+	{
+		*list_ptr = next;
+	}
+	
+	task_to_remove->delta_next = NULL;
+	task_to_remove->delta_prev = NULL;
+}
+
+
 /**
 * @brief Update the current time.
 *
@@ -787,36 +1170,63 @@ static task_descriptor_t* dequeue(queue_t* queue_ptr)
 static void kernel_update_ticker(void)
 {
 	/* PORTD ^= LED_D5_RED; */
+	uint16_t elapsed = 1;
+	uint16_t sleep_elapsed;
+	
+#ifdef TICKLESS
+	/* Several ticks may have gone by since the last timer interrupt. */
+	elapsed = (uint16_t)(TCNT1 - timer_time) / TICK_CYCLES;
+	if(elapsed == 0){
+		return;
+	}
+#endif
 	
-	++running_time;
-	timer_time = TCNT1;
+	running_time += elapsed;
+	timer_time += elapsed * TICK_CYCLES;
+	sleep_elapsed = elapsed;
 	
-	if(cur_task != NULL && cur_task->state == RUNNING && cur_task->level == PERIODIC){
-		//check worst ex. time remaining on task, abort if 0 time
-		if(cur_task->wcet > 0){
-			cur_task->wcet--;
-			}else{
-			error_msg = ERR_RUN_3_PERIODIC_TOOK_TOO_LONG;
-			OS_Abort();
+	//release every periodic task due by now, only the head is looked at otherwise
+	while(release_list != NULL && release_list->delta <= elapsed){
+		task_descriptor_t* p = release_list;
+		
+		/* The list's reference time moves to this release. */
+		elapsed -= p->delta;
+		release_list = p->delta_next;
+		if(release_list != NULL){
+			release_list->delta_prev = NULL;
 		}
+		
+		p->state = READY;
+		enqueue(&per_queue, p);
+		p->budget = (uint32_t)p->wcet * TICK_CYCLES;
+		delta_insert(&release_list, p, p->period);
 	}
-	//update periodic tasks
-	for(int i = 0; i < MAXPROCESS; i++){
-		//check not null
-		if(task_in_PPP[i] != NULL){
-			
-			task_in_PPP[i]->time_remaining --;
-			//check time remaining
-			if(task_in_PPP[i]->time_remaining <= 0){
-				//if no periodic currently running/ready
-					task_in_PPP[i]->state = READY;
-					enqueue(&per_queue, task_in_PPP[i]);
-					task_in_PPP[i]->time_remaining = task_in_PPP[i]->period;
-					task_in_PPP[i]->wcet_remaining = task_in_PPP[i]->wcet;
-			
-			}
-			
+	if(release_list != NULL){
+		release_list->delta -= elapsed;
+	}
+	
+	//wake every sleeper due by now, O(1) per task woken
+	while(sleep_list != NULL && sleep_list->delta <= sleep_elapsed){
+		task_descriptor_t* p = sleep_list;
+		
+		sleep_elapsed -= p->delta;
+		sleep_list = p->delta_next;
+		if(sleep_list != NULL){
+			sleep_list->delta_prev = NULL;
 		}
+		p->delta_next = NULL;
+		
+		/* A timed out subscriber leaves its service without waking. */
+		if(p->service != NULL){
+			queue_remove(&p->service->task_list, p);
+			p->service->waiting--;
+			p->service = NULL;
+			p->timed_out = 1;
+		}
+		kernel_wake_task(p);
+	}
+	if(sleep_list != NULL){
+		sleep_list->delta -= sleep_elapsed;
 	}
 	
 /*	//scheduling conflicts
@@ -830,383 +1240,1517 @@ static void kernel_update_ticker(void)
 }
 
 
-#undef SLOW_CLOCK
+/**
+* @brief Set the Timer 1 compare for the next time the kernel needs to run.
+*
+* Without TICKLESS this is simply the next tick boundary. With TICKLESS it is
+* the tick boundary of the next scheduling event, so idle ticks cost nothing.
+*/
+static void kernel_program_timer(void)
+{
+#ifdef TICKLESS
+	uint16_t ahead = kernel_next_event() * TICK_CYCLES;
+	uint16_t target = timer_time + ahead;
+	
+	/* The event boundary already went by while in the kernel; catch up right away. */
+	if((uint16_t)(target - TCNT1) > ahead){
+		target = TCNT1 + TICKLESS_MIN_CYCLES;
+	}
+	
+	OCR1A = target;
+#else
+	OCR1A = timer_time + TICK_CYCLES;
+#endif
+}
 
-#ifdef SLOW_CLOCK
+
+#ifdef TICKLESS
 /**
-* @brief For DEBUGGING to make the clock run slower
+* @brief Number of ticks from the last tick boundary to the next scheduling event.
 *
-* Divide CLKI/O by 64 on timer 1 to run at 125 kHz  CS3[210] = 011
-* 1 MHz CS3[210] = 010
+* @return between 1 and TICKLESS_MAX_TICKS
 */
-static void kernel_slow_clock(void)
+static uint16_t kernel_next_event(void)
 {
-	TCCR1B &= ~(_BV(CS12) | _BV(CS10));
-	TCCR1B |= (_BV(CS11));
+	uint16_t next = TICKLESS_MAX_TICKS;
+	
+	/* RR quantum end, only matters if another RR task is waiting for it. */
+	if(cur_task->level == RR && rr_queue.head != NULL){
+		return 1;
+	}
+	
+	/* Next sleep timeout. */
+	if(sleep_list != NULL && sleep_list->delta < next){
+		next = sleep_list->delta;
+	}
+	
+	/* Next periodic release. */
+	if(release_list != NULL && release_list->delta < next){
+		next = release_list->delta;
+	}
+	
+	return next > 0 ? next : 1;
 }
 #endif
 
+
 /**
-* @brief Setup the RTOS and create main() as the first SYSTEM level task.
+* @brief Start timing the budget of the PERIODIC task about to run on OCR1B.
 *
-* Point of entry from the C runtime crt0.S.
+* Only time the task actually runs is charged: the compare is armed just
+* before exit_kernel() and stopped by kernel_charge_budget() as soon as the
+* kernel is back, so preemptions and kernel time are not counted.
 */
-void OS_Init()
+static void kernel_arm_budget(void)
 {
-	int i;
+	uint16_t ahead;
 	
-	/* Set up the clocks */
-	TCCR1A = 0;
-	TCCR1B |= (_BV(CS11));
+	if(cur_task->level != PERIODIC){
+		return;
+	}
 	
-	#ifdef SLOW_CLOCK
-	kernel_slow_clock();
-	#endif
+	if(cur_task->budget == 0){
+		error_msg = ERR_RUN_3_PERIODIC_TOOK_TOO_LONG;
+		OS_Abort();
+	}
 	
+	ahead = cur_task->budget < BUDGET_CHUNK ? (uint16_t)cur_task->budget : BUDGET_CHUNK;
+	if(ahead < BUDGET_MIN_CYCLES){
+		ahead = BUDGET_MIN_CYCLES;
+	}
 	
+	TIFR1 = _BV(OCF1B);
+	budget_since = TCNT1;
+	OCR1B = budget_since + ahead;
+	TIMSK1 |= _BV(OCIE1B);
+	budget_armed = 1;
+}
+
+
+/**
+* @brief Stop the budget compare and charge the task for the time it just ran.
+*/
+static void kernel_charge_budget(void)
+{
+	uint16_t used;
 	
-	/*
-	* Initialize dead pool to contain all but last task descriptor.
-	*
-	* DEAD == 0, already set in .init4
-	*/
-	for (i = 0; i < MAXPROCESS - 1; i++)
-	{
-		task_desc[i].state = DEAD;
-		task_in_PPP[i] = NULL;
-		//name_to_task_ptr[i] = NULL;
-		task_desc[i].next = &task_desc[i + 1];
+	if(!budget_armed){
+		return;
 	}
-	task_in_PPP[MAXPROCESS-1] = NULL;
-	task_desc[MAXPROCESS - 1].next = NULL;
-	dead_pool_queue.head = &task_desc[0];
-	dead_pool_queue.tail = &task_desc[MAXPROCESS - 1];
 	
-	/* Create idle "task" */
-	kernel_request_create_args.f = (voidfuncvoid_ptr)idle;
-	kernel_request_create_args.level = NULL;
-	kernel_create_task();
+	TIMSK1 &= ~_BV(OCIE1B);
+	budget_armed = 0;
 	
-	/* Create "main" task as SYSTEM level. */
-	kernel_request_create_args.f = (voidfuncvoid_ptr)r_main;
-	kernel_request_create_args.level = SYSTEM;
-	kernel_create_task();
+	used = TCNT1 - budget_since;
+	cur_task->budget = used < cur_task->budget ? cur_task->budget - used : 0;
+}
+
+
+/**
+* @fn TIMER1_COMPB_vect
+*
+* @brief The running PERIODIC task used up the piece of its budget OCR1B was timing.
+*
+* The overrun is caught at the cycle it happens, not at the next tick. A budget
+* longer than BUDGET_CHUNK is timed in pieces, so this may only re-arm OCR1B.
+*/
+ISR(TIMER1_COMPB_vect)
+{
+	uint16_t timed = OCR1B - budget_since;
 	
-	/* First time through. Select "main" task to run first. */
-	cur_task = task_desc;
-	cur_task->state = RUNNING;
-	dequeue(&system_queue);
+	if(cur_task->budget <= timed){
+		cur_task->budget = 0;
+		error_msg = ERR_RUN_3_PERIODIC_TOOK_TOO_LONG;
+		OS_Abort();
+	}
 	
-	/* Set up Timer 1 Output Compare interrupt,the TICK clock. */
-	TIMSK1 |= _BV(OCIE1A);
-	OCR1A = TICK_CYCLES;
-	TCNT1 = 0;
-	/* Clear flag. */
-	TIFR1 = _BV(OCF1A);
+	cur_task->budget -= timed;
+	budget_since = OCR1B;
+	OCR1B += cur_task->budget < BUDGET_CHUNK ? (uint16_t)cur_task->budget : BUDGET_CHUNK;
+}
+
+
+/**
+* @brief Tick boundaries that have gone by since timer_time but are not counted yet.
+*
+* Usually 0; in tickless mode up to the programmed horizon.
+*/
+static uint16_t kernel_ticks_pending(void)
+{
+	return (uint16_t)(TCNT1 - timer_time) / TICK_CYCLES;
+}
+
+
+/**
+* @brief Make a running PERIODIC or RR task READY, to give way to a SYSTEM task.
+*/
+static void kernel_preempt(void)
+{
+	if(cur_task->state == RUNNING && (cur_task->level == PERIODIC || cur_task->level == RR))
+	{
+		cur_task->state = READY;
+		enqueue(cur_task->level == PERIODIC ? &per_queue : &rr_queue, cur_task);
+	}
+}
+
+
+/**
+* @brief Make a WAITING SYSTEM or RR task READY again.
+*
+* A SYSTEM task pre-empts a running PERIODIC or RR task.
+*/
+static void kernel_wake_task(task_descriptor_t* p)
+{
+	p->state = READY;
 	
-	//NOTE
-	/*
-	* The main loop of the RTOS kernel.
-	*/
-	kernel_main_loop();
+	if(p->level == SYSTEM)
+	{
+		enqueue(&system_queue, p);
+		kernel_preempt();
+	}
+	else
+	{
+		enqueue(&rr_queue, p);
+	}
+}
+
+
+/**
+* @brief Wake a task from Task_NotifyWait(), cancelling its timeout, if its word now has a bit it waits for.
+*
+* A task notified twice before it runs is only woken once, since it is no longer WAITING.
+*/
+static void kernel_notify_wake(task_descriptor_t* p)
+{
+	if(p->state == WAITING && (p->notify & p->notify_mask))
+	{
+		delta_remove(&sleep_list, p);
+		kernel_wake_task(p);
+	}
 }
 
 
+/**
+* @brief Hand a semaphore unit to its first waiting task, SYSTEM before RR, or add it to the count.
+*/
+static void kernel_semaphore_give(SEMAPHORE* s)
+{
+	task_descriptor_t* p;
+	
+	p = dequeue(&s->waiters[0]);
+	if(p == NULL)
+	{
+		p = dequeue(&s->waiters[1]);
+	}
+	
+	if(p != NULL)
+	{
+		kernel_wake_task(p);
+	}
+	else
+	{
+		s->count++;
+	}
+}
 
 
 /**
-*  @brief Delay function adapted from <util/delay.h>
+* @brief Hand a block to the first task waiting on its pool, SYSTEM before RR, or put it back.
 */
-static void _delay_25ms(void)
+static void kernel_pool_free(POOL* p, void* block)
 {
-	//uint16_t i;
+	task_descriptor_t* t;
 	
-	/* 4 * 50000 CPU cycles = 25 ms */
-	//asm volatile ("1: sbiw %0,1" "\n\tbrne 1b" : "=w" (i) : "0" (50000));
-	_delay_ms(25);
+	t = dequeue(&p->waiters[0]);
+	if(t == NULL)
+	{
+		t = dequeue(&p->waiters[1]);
+	}
+	
+	if(t != NULL)
+	{
+		/* Still in use, now by t. */
+		t->block = block;
+		kernel_wake_task(t);
+	}
+	else
+	{
+		pool_put(p, block);
+	}
 }
 
 
-/** @brief Abort the execution of this RTOS due to an unrecoverable erorr.
+/**
+* @return non-zero if flags satisfy a wait for bits in the given mode
 */
-void OS_Abort(void)
+static uint8_t event_satisfied(uint16_t flags, uint16_t bits, uint8_t mode)
 {
-	uint8_t i, j;
-	uint8_t flashes;
+	return (mode & EVENT_WAIT_ALL) ? (flags & bits) == bits : (flags & bits) != 0;
+}
+
+
+/**
+* @brief Wake every task waiting on the group whose wait its flags now satisfy.
+*
+* All waits are judged against the same flags; those asking for EVENT_CLEAR
+* have their bits cleared only after every waiter has been looked at.
+*/
+static void kernel_event_check(EVENT_GROUP* g)
+{
+	queue_t waiting = g->waiters;
+	task_descriptor_t* p;
+	uint16_t clear = 0;
 	
-	Disable_Interrupt();
+	g->waiters.head = NULL;
+	g->waiters.tail = NULL;
+	g->wanted = 0;
 	
-	/* Initialize port for output */
-	DDRB = ERROR_LED;
+	while((p = dequeue(&waiting)) != NULL)
+	{
+		if(event_satisfied(g->flags, p->wait_bits, p->wait_mode))
+		{
+			if(p->wait_mode & EVENT_CLEAR)
+			{
+				clear |= p->wait_bits;
+			}
+			p->wait_bits = g->flags;
+			kernel_wake_task(p);
+		}
+		else
+		{
+			enqueue(&g->waiters, p);
+			g->wanted |= p->wait_bits;
+		}
+	}
 	
-	if(error_msg < ERR_RUN_1_USER_CALLED_OS_ABORT)
+	g->flags &= ~clear;
+}
+
+
+/**
+* @brief Hand the published value to every subscriber of the service and make them all READY.
+*
+* All waiters are moved in one pass of a single kernel request. kernel_wake_task()
+* pre-empts the publisher at most once, however many SYSTEM subscribers there are.
+* On a payload service v is a block index, and the publisher's reference to it is dropped.
+*/
+static void kernel_service_publish(SERVICE* s, int16_t v)
+{
+	task_descriptor_t* p;
+	
+	while((p = dequeue(&s->task_list)) != NULL)
 	{
-		flashes = error_msg + 1; // initialize time error
+		/* Cancel the timeout of Service_Subscribe_Timeout(). */
+		if(p->service != NULL)
+		{
+			p->service = NULL;
+			delta_remove(&sleep_list, p);
+		}
 		
-		for(;;){
-			//flash on for 2 second on, off for 1 seconds
-			PORTB = ERROR_LED;
-			for(;;){
-				for(i = 0; i < 80; ++i){
-					_delay_25ms();
-				}
+		if(s->ring != NULL)
+		{
+			service_take(s, p);
+		}
+		else
+		{
+			*p->value = v;
+			if(s->payload)
+			{
+				payload_refs[v]++;
 			}
-			PORTB = (uint8_t) 0;
-			for(;;){
-				for(i = 0; i < 40; ++i){
-					_delay_25ms();
-				}
+		}
+		kernel_wake_task(p);
+	}
+	
+	s->waiting = 0;
+	
+	if(s->payload)
+	{
+		payload_drop(v);
+	}
+}
+
+
+/**
+* @brief Carry out the requests ISRs queued since the last kernel entry, oldest first.
+*/
+static void kernel_drain_isr_requests(void)
+{
+	isr_request_t* r;
+	
+	while(isr_tail != isr_head)
+	{
+		r = &isr_queue[isr_tail];
+		
+		switch(r->type)
+		{
+		case ISR_PUBLISH:
+			kernel_service_publish((SERVICE*)r->object, r->value);
+			break;
+			
+		case ISR_CREATE:
+			kernel_request_create_args.f = (voidfuncvoid_ptr)r->object;
+			kernel_request_create_args.arg = r->value;
+			kernel_request_create_args.level = r->level;
+			if(kernel_create_task() && r->level == SYSTEM)
+			{
+				kernel_preempt();
 			}
+			break;
 			
-			// flash number of error code half second on. half off
+		case ISR_NOTIFY:
+			kernel_notify_wake((task_descriptor_t*)r->object);
+			break;
 			
-			for(j = 0; j < flashes; j++){
-				PORTB = ERROR_LED;
-				for(i = 0; i < 20; ++i){
-					_delay_25ms();
-				}
-				PORTB = 0;
-				for(i = 0; i < 20; ++i){
-					_delay_25ms();
-				}
-			}
+		case ISR_SEMAPHORE_GIVE:
+			kernel_semaphore_give((SEMAPHORE*)r->object);
+			break;
 			
-			//wait before code repeat
-			for(i = 0; i < 20; ++i){
-				_delay_25ms();
-			}
+		case ISR_EVENT_SET:
+			kernel_event_check((EVENT_GROUP*)r->object);
+			break;
+			
+		case ISR_POOL_FREE:
+			kernel_pool_free((POOL*)r->object, (void*)(uint16_t)r->value);
+			break;
 		}
+		
+		isr_tail = (isr_tail + 1) & (ISR_QUEUE_SIZE - 1);
 	}
-	else//run time error
+	
+	TIMSK1 &= ~_BV(OCIE1C);
+}
+
+
+/**
+* @brief Feasibility test for the PERIODIC task in kernel_request_create_args.
+*
+* Jobs of two tasks with periods P1, P2 start at every relative offset congruent
+* to their phase difference modulo g = gcd(P1, P2). So the two never overlap iff
+* that difference r (taken in [0, g)) leaves room for both: wcet1 <= r <= g - wcet2.
+* Checking every admitted task this way is exact and O(n), without expanding
+* the hyperperiod. Phases are the next releases in release_list, so wrap-around
+* of running_time does not matter. Every entry there is at least 1 tick ahead,
+* the same phase a past-due start is given.
+*
+* @return 1 if the task can be admitted, 0 otherwise
+*/
+static int kernel_admit_periodic(void)
+{
+	uint16_t period = kernel_request_create_args.period;
+	uint16_t wcet = kernel_request_create_args.wcet;
+	uint16_t utilization;
+	int32_t first;
+	int32_t next = 0;
+	task_descriptor_t* p;
+	
+	if(wcet == 0 || wcet >= period)
 	{
-		flashes = error_msg + 1 - ERR_RUN_1_USER_CALLED_OS_ABORT; // runtime error number
+		return 0;
+	}
+	
+	utilization = (uint16_t)(((uint32_t)wcet << 10) / period);
+	if(periodic_utilization + utilization > 1024)
+	{
+		return 0;
+	}
+	
+	/* First release in ticks from timer_time; a start already past is released on the next tick. */
+	first = (int16_t)(kernel_request_create_args.start - running_time);
+	if(first < 1)
+	{
+		first = 1;
+	}
+	
+	for(p = release_list; p != NULL; p = p->delta_next)
+	{
+		uint16_t g = gcd(period, p->period);
+		int32_t r;
 		
-		for(;;){
-			
-			//flash on for 3 second on, off for 1 seconds
-			flashes = error_msg + 1;
-			PORTB = ERROR_LED;
-			for(;;){
-				for(i = 0; i < 120; ++i){
-					_delay_25ms();
-				}
-			}
-			PORTB = (uint8_t) 0;
-			for(;;){
-				for(i = 0; i < 40; ++i){
-					_delay_25ms();
-				}
-			}
-			
-			//flash run time error number quarter second on. quarter off
-			for(j = 0; j < flashes; ++j){
-				PORTB = ERROR_LED;
-				
-				for(i = 0; i < 10; ++i){
-					_delay_25ms();
-				}
-				
-				PORTB = (uint8_t) 0;
-				
-				for(i = 0; i < 10; ++i){
-					_delay_25ms();
-				}
-			}
-			//wait before code repeat
-			for(i = 0; i < 20; ++i){
-				_delay_25ms();
-			}
+		next += p->delta;
+		r = (first - next) % g;
+		if(r < 0)
+		{
+			r += g;
+		}
+		
+		if(r < p->wcet || g - r < wcet)
+		{
+			return 0;
 		}
 	}
+	
+	return 1;
+}
+
+
+/**
+* @brief Greatest common divisor, for kernel_admit_periodic().
+*/
+static uint16_t gcd(uint16_t a, uint16_t b)
+{
+	while(b != 0)
+	{
+		uint16_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+
+#undef SLOW_CLOCK
+
+#ifdef SLOW_CLOCK
+/**
+* @brief For DEBUGGING to make the clock run slower
+*
+* Divide CLKI/O by 64 on timer 1 to run at 125 kHz  CS3[210] = 011
+* 1 MHz CS3[210] = 010
+*/
+static void kernel_slow_clock(void)
+{
+	TCCR1B &= ~(_BV(CS12) | _BV(CS10));
+	TCCR1B |= (_BV(CS11));
+}
+#endif
+
+/**
+* @brief Setup the RTOS and create main() as the first SYSTEM level task.
+*
+* Point of entry from the C runtime crt0.S.
+*/
+void OS_Init()
+{
+	int i;
+	
+	/* Set up the clocks */
+	TCCR1A = 0;
+	TCCR1B |= (_BV(CS11));
+	
+	#ifdef SLOW_CLOCK
+	kernel_slow_clock();
+	#endif
+	
+	
+	
+	/*
+	* Initialize dead pool to contain all but last task descriptor.
+	*
+	* DEAD == 0, already set in .init4
+	*/
+	for (i = 0; i < MAXPROCESS - 1; i++)
+	{
+		task_desc[i].state = DEAD;
+		//name_to_task_ptr[i] = NULL;
+		task_desc[i].next = &task_desc[i + 1];
+	}
+	task_desc[MAXPROCESS - 1].next = NULL;
+	dead_pool_queue.head = &task_desc[0];
+	dead_pool_queue.tail = &task_desc[MAXPROCESS - 1];
+	
+	pool_setup(&payload_blocks);
+	
+	/* Create idle "task" */
+	kernel_request_create_args.f = (voidfuncvoid_ptr)idle;
+	kernel_request_create_args.level = NULL;
+	kernel_create_task();
+	
+	/* Create "main" task as SYSTEM level. */
+	kernel_request_create_args.f = (voidfuncvoid_ptr)r_main;
+	kernel_request_create_args.level = SYSTEM;
+	kernel_create_task();
+	
+	/* First time through. Select "main" task to run first. */
+	cur_task = task_desc;
+	cur_task->state = RUNNING;
+	dequeue(&system_queue);
+	
+	/* Set up Timer 1 Output Compare interrupt,the TICK clock. */
+	TIMSK1 |= _BV(OCIE1A);
+	OCR1A = TICK_CYCLES;
+	TCNT1 = 0;
+	/* Clear flag. */
+	TIFR1 = _BV(OCF1A);
+	
+	//NOTE
+	/*
+	* The main loop of the RTOS kernel.
+	*/
+	kernel_main_loop();
+}
+
+
+
+
+/**
+*  @brief Delay function adapted from <util/delay.h>
+*/
+static void _delay_25ms(void)
+{
+	//uint16_t i;
+	
+	/* 4 * 50000 CPU cycles = 25 ms */
+	//asm volatile ("1: sbiw %0,1" "\n\tbrne 1b" : "=w" (i) : "0" (50000));
+	_delay_ms(25);
+}
+
+
+/** @brief Abort the execution of this RTOS due to an unrecoverable erorr.
+*/
+void OS_Abort(void)
+{
+	uint8_t i, j;
+	uint8_t flashes;
+	
+	Disable_Interrupt();
+	
+	/* Initialize port for output */
+	DDRB = ERROR_LED;
+	
+	if(error_msg < ERR_RUN_1_USER_CALLED_OS_ABORT)
+	{
+		flashes = error_msg + 1; // initialize time error
+		
+		for(;;){
+			//flash on for 2 second on, off for 1 seconds
+			PORTB = ERROR_LED;
+			for(;;){
+				for(i = 0; i < 80; ++i){
+					_delay_25ms();
+				}
+			}
+			PORTB = (uint8_t) 0;
+			for(;;){
+				for(i = 0; i < 40; ++i){
+					_delay_25ms();
+				}
+			}
+			
+			// flash number of error code half second on. half off
+			
+			for(j = 0; j < flashes; j++){
+				PORTB = ERROR_LED;
+				for(i = 0; i < 20; ++i){
+					_delay_25ms();
+				}
+				PORTB = 0;
+				for(i = 0; i < 20; ++i){
+					_delay_25ms();
+				}
+			}
+			
+			//wait before code repeat
+			for(i = 0; i < 20; ++i){
+				_delay_25ms();
+			}
+		}
+	}
+	else//run time error
+	{
+		flashes = error_msg + 1 - ERR_RUN_1_USER_CALLED_OS_ABORT; // runtime error number
+		
+		for(;;){
+			
+			//flash on for 3 second on, off for 1 seconds
+			flashes = error_msg + 1;
+			PORTB = ERROR_LED;
+			for(;;){
+				for(i = 0; i < 120; ++i){
+					_delay_25ms();
+				}
+			}
+			PORTB = (uint8_t) 0;
+			for(;;){
+				for(i = 0; i < 40; ++i){
+					_delay_25ms();
+				}
+			}
+			
+			//flash run time error number quarter second on. quarter off
+			for(j = 0; j < flashes; ++j){
+				PORTB = ERROR_LED;
+				
+				for(i = 0; i < 10; ++i){
+					_delay_25ms();
+				}
+				
+				PORTB = (uint8_t) 0;
+				
+				for(i = 0; i < 10; ++i){
+					_delay_25ms();
+				}
+			}
+			//wait before code repeat
+			for(i = 0; i < 20; ++i){
+				_delay_25ms();
+			}
+		}
+	}
+}
+
+
+/**
+* @param f  a parameterless function to be created as a process instance
+* @param arg an integer argument to be assigned to this process instanace
+* @param level assigned scheduling level: SYSTEM, PERIODIC or RR
+* @param name assigned PERIODIC process name
+* @return 0 if not successful; otherwise non-zero.
+* @sa Task_GetArg(), PPP[].
+*
+*  A new process  is created to execute the parameterless
+*  function @a f with an initial parameter @a arg, which is retrieved
+*  by a call to Task_GetArg().  If a new process cannot be
+*  created, 0 is returned; otherwise, it returns non-zero.
+*  The created process will belong to its scheduling @a level.
+*  If the process is PERIODIC, then its @a name is a user-specified name
+*  to be used in the PPP[] array. Otherwise, @a name is ignored.
+* @sa @ref policy
+*/
+int Task_Create(void (*f)(void), int arg, unsigned int level, unsigned int name)
+{
+	int retval;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
+	kernel_request_create_args.arg = arg;
+	kernel_request_create_args.level = (uint8_t)level;
+	kernel_request_create_args.name = (uint8_t)name;
+	
+	kernel_request = TASK_CREATE;
+	enter_kernel();
+	
+	retval = kernel_request_retval;
+	SREG = sreg;
+	
+	return retval;
+}
+
+
+
+/**
+* @brief The calling task gives up its share of the processor voluntarily.
+*/
+void Task_Next()
+{
+	uint8_t volatile sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request = TASK_NEXT;
+	enter_kernel();
+	
+	SREG = sreg;
+}
+
+
+/**
+* @brief The calling task terminates itself.
+*/
+void Task_Terminate()
+{
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request = TASK_TERMINATE;
+	enter_kernel();
+	
+	SREG = sreg;
+}
+
+
+/**
+* @brief The calling task sleeps for a number of ticks.
+*/
+void Task_Sleep(uint16_t ticks)
+{
+	uint8_t sreg;
+	
+	if(ticks == 0)
+	{
+		Task_Next();
+		return;
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request_ticks = ticks;
+	kernel_request = TASK_SLEEP;
+	enter_kernel();
+	
+	SREG = sreg;
+}
+
+
+/**
+* @brief The calling task sleeps until a tick a whole period after its last wake-up.
+*/
+void Task_Delay_Until(uint16_t *last_wake, uint16_t period)
+{
+	uint8_t sreg;
+	uint16_t ticks;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	*last_wake += period;
+	ticks = *last_wake - (running_time + kernel_ticks_pending());
+	
+	/* Only sleep if the wake-up tick is still ahead. */
+	if((int16_t)ticks > 0)
+	{
+		kernel_request_ticks = ticks;
+		kernel_request = TASK_SLEEP;
+		enter_kernel();
+	}
+	
+	SREG = sreg;
+}
+
+
+TASK* Task_Self()
+{
+	return cur_task;
+}
+
+
+void Task_Notify(TASK* t, uint16_t value, uint8_t action)
+{
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	switch(action)
+	{
+	case NOTIFY_SET_BITS:
+		t->notify |= value;
+		break;
+		
+	case NOTIFY_INCREMENT:
+		t->notify++;
+		break;
+		
+	default:
+		t->notify = value;
+		break;
+	}
+	
+	/* Only enter the kernel if this wakes the task. */
+	if(t->state == WAITING && (t->notify & t->notify_mask))
+	{
+		if(sreg & _BV(SREG_I))
+		{
+			kernel_request_task = t;
+			kernel_request = TASK_NOTIFY;
+			enter_kernel();
+		}
+		else if(!isr_request(ISR_NOTIFY, 0, 0, t))
+		{
+			error_msg = ERR_RUN_9_ISR_QUEUE_FULL;
+			OS_Abort();
+		}
+	}
+	
+	SREG = sreg;
+}
+
+
+uint16_t Task_NotifyWait(uint16_t mask, uint16_t timeout)
+{
+	uint16_t bits;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	if(!(cur_task->notify & mask))
+	{
+		cur_task->notify_mask = mask;
+		kernel_request_ticks = timeout;
+		kernel_request = TASK_NOTIFY_WAIT;
+		enter_kernel();
+		cur_task->notify_mask = 0;
+	}
+	
+	bits = cur_task->notify & mask;
+	cur_task->notify &= ~mask;
+	
+	SREG = sreg;
+	
+	return bits;
+}
+
+
+/** @brief Retrieve the assigned parameter.
+*/
+int Task_GetArg(void)
+{
+	int arg;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	arg = cur_task->arg;
+	
+	SREG = sreg;
+	
+	return arg;
+}
+
+uint16_t Now() {
+	//Disable interrupts before calcs
+	uint16_t now_time;
+	uint8_t sreg = SREG;
+	Disable_Interrupt();
+	
+	now_time = running_time * TICK + ((TCNT1 - timer_time)/(F_CPU/TIMER_PRESCALER/1000)); 
+	
+	SREG = sreg;
+	
+	return now_time;
+}
+
+uint16_t Now_Ticks() {
+	uint16_t ticks;
+	uint8_t sreg = SREG;
+	Disable_Interrupt();
+	
+	ticks = running_time + kernel_ticks_pending();
+	
+	SREG = sreg;
+	
+	return ticks;
+}
+
+SERVICE* Service_Init() {
+	//make sure we don't have too many services going
+	if(service_cntr >= MAXSERVICE) {
+		error_msg = ERR_RUN_1_USER_CALLED_OS_ABORT; //create new error message for this
+		OS_Abort();
+	}
+
+	services[service_cntr].value = 0;
+	services[service_cntr].waiting = 0;
+	services[service_cntr].task_list.head = NULL;
+	services[service_cntr].task_list.tail = NULL;
+	services[service_cntr].ring = NULL;
+	services[service_cntr].mask = 0;
+	services[service_cntr].head = 0;
+	services[service_cntr].payload = 0;
+
+	return &(services[service_cntr++]);
+}
+
+SERVICE* Service_Init_Queued(uint8_t depth) {
+	SERVICE* s = NULL;
+	uint8_t sreg;
+	
+	/* The ring is indexed by masking the sequence number. */
+	if(depth == 0 || (depth & (depth - 1)) != 0) {
+		return NULL;
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	/* Checked and carved in one critical section, so two tasks cannot over-commit the pool. */
+	if(service_cntr < MAXSERVICE && service_ring_used + depth <= SERVICE_RING_POOL) {
+		s = Service_Init();
+		s->ring = &service_ring_pool[service_ring_used];
+		s->mask = depth - 1;
+		service_ring_used += depth;
+	}
+	
+	SREG = sreg;
+	
+	return s;
+}
+
+/**
+* @brief Give the task the next value it has not read from a queued service.
+*
+* If the task fell more than a ring behind, the values it missed are skipped
+* and it gets the oldest one still in the ring. Interrupts must be disabled.
+*/
+static void service_take(SERVICE* s, task_descriptor_t* p)
+{
+	uint8_t i = s - services;
+	
+	if((uint16_t)(s->head - p->cursor[i]) > (uint16_t)s->mask + 1)
+	{
+		p->cursor[i] = s->head - s->mask - 1;
+	}
+	
+	*p->value = s->ring[p->cursor[i] & s->mask];
+	p->cursor[i]++;
+}
+
+void Service_Subscribe( SERVICE *s, int16_t *v ) {
+	Service_Subscribe_Timeout(s, v, SERVICE_FOREVER);
+}
+
+int8_t Service_Subscribe_Timeout( SERVICE *s, int16_t *v, uint16_t ticks ) {
+	/* A payload service delivers block references, which only Service_Subscribe_Payload() takes. */
+	if(s->payload)
+	{
+		error_msg = ERR_RUN_10_PAYLOAD_MISUSE;
+		OS_Abort();
+	}
+	
+	return service_subscribe(s, v, ticks);
+}
+
+/**
+* @brief Wait for the next value of any kind of service, up to ticks ticks (SERVICE_FOREVER for no limit).
+*/
+static int8_t service_subscribe(SERVICE* s, int16_t* v, uint16_t ticks)
+{
+	uint8_t sreg;
+	int8_t result = SERVICE_RECEIVED;
+	
+	uint8_t i = s - services;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	cur_task->value = v;
+	
+	if(s->ring != NULL)
+	{
+		/* The first subscription starts with the next value published. */
+		if(!(cur_task->subscribed & _BV(i)))
+		{
+			cur_task->subscribed |= _BV(i);
+			cur_task->cursor[i] = s->head;
+		}
+		
+		/* Values published while the task was busy are read without waiting. */
+		if(cur_task->cursor[i] != s->head)
+		{
+			service_take(s, cur_task);
+			SREG = sreg;
+			return result;
+		}
+	}
+	
+	cur_task->timed_out = 0;
+	kernel_request_service = s;
+	kernel_request_ticks = ticks;
+	kernel_request = SERVICE_SUBSCRIBE;
+	enter_kernel();
+	
+	if(cur_task->timed_out)
+	{
+		result = SERVICE_TIMEOUT;
+	}
+	
+	SREG = sreg;
+	
+	return result;
+}
+
+void abort(int msg) {
+	//TODO: need to update error message codes
+	//TODO: add tracing
+	error_msg = msg;
+	OS_Abort();
+}
+
+/**
+* @brief Queue a request for the kernel from an ISR, and raise the soft interrupt that carries it out.
+*
+* ISRs do not nest, so the queue has a single producer at a time and needs no lock.
+* Output compare C of Timer 1 serves as the soft interrupt: it is set to match
+* ISR_SOFT_IRQ_CYCLES timer counts ahead, so it becomes pending within a few cycles
+* and is taken right after the calling ISR returns, entering the kernel like a tick.
+* Interrupts must be disabled.
+*
+* @return 1 if queued, 0 if the queue is full
+*/
+static uint8_t isr_request(uint8_t type, uint8_t level, int16_t value, void* object)
+{
+	uint8_t head = isr_head;
+	uint8_t next = (head + 1) & (ISR_QUEUE_SIZE - 1);
+	
+	if(next == isr_tail)
+	{
+		return 0;
+	}
+	
+	isr_queue[head].type = type;
+	isr_queue[head].level = level;
+	isr_queue[head].value = value;
+	isr_queue[head].object = object;
+	isr_head = next;
+	
+	if(!(TIMSK1 & _BV(OCIE1C)))
+	{
+		/* Clear any stale match before arming, not after, or the match just
+		 * armed could be cleared with it. If TCNT1 still got past OCR1C
+		 * before the compare could fire, arm again. */
+		TIFR1 = _BV(OCF1C);
+		do
+		{
+			OCR1C = TCNT1 + ISR_SOFT_IRQ_CYCLES;
+		}
+		while(!(TIFR1 & _BV(OCF1C)) && (int16_t)(TCNT1 - OCR1C) > 0);
+		TIMSK1 |= _BV(OCIE1C);
+	}
+	
+	return 1;
+}
+
+/**
+* @brief Publish with interrupts disabled. sreg is the caller's SREG, telling whether it may enter the kernel.
+*/
+static void service_publish(SERVICE* s, int16_t v, uint8_t sreg)
+{
+	s->value = v;
+	
+	if(s->ring != NULL)
+	{
+		s->ring[s->head & s->mask] = v;
+		s->head++;
+	}
+	
+	/* Nobody to wake: a plain service loses the value, a queued one keeps it in the ring. */
+	if(s->waiting != 0)
+	{
+		if(sreg & _BV(SREG_I))
+		{
+			kernel_request_service = s;
+			kernel_request_value = v;
+			kernel_request = SERVICE_PUBLISH;
+			enter_kernel();
+		}
+		else if(!isr_request(ISR_PUBLISH, 0, v, s))
+		{
+			error_msg = ERR_RUN_9_ISR_QUEUE_FULL;
+			OS_Abort();
+		}
+	}
+}
+
+void Service_Publish( SERVICE *s, int16_t v ) {
+	uint8_t sreg;
+	
+	/* The kernel would count v as a payload block reference. */
+	if(s->payload)
+	{
+		error_msg = ERR_RUN_10_PAYLOAD_MISUSE;
+		OS_Abort();
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	service_publish(s, v, sreg);
+	
+	SREG = sreg;
+}
+
+SERVICE* Service_Init_Payload() {
+	SERVICE* s;
+	
+	s = Service_Init();
+	s->payload = 1;
+	
+	return s;
+}
+
+void* Payload_Alloc() {
+	uint8_t sreg;
+	uint8_t* block;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	block = (uint8_t*)pool_take(&payload_blocks);
+	if(block != NULL)
+	{
+		payload_refs[(block - payload_pool[0]) / sizeof(payload_pool[0])] = 1;
+	}
+	
+	SREG = sreg;
+	
+	return block;
 }
 
+/**
+* @brief Index of a payload block, aborting if block is not the start of one.
+*/
+static uint8_t payload_index(void* block)
+{
+	uint16_t offset = (uint8_t*)block - payload_pool[0];
+	
+	if((uint8_t*)block < payload_pool[0] || offset >= sizeof(payload_pool) ||
+		offset % sizeof(payload_pool[0]) != 0)
+	{
+		error_msg = ERR_RUN_10_PAYLOAD_MISUSE;
+		OS_Abort();
+	}
+	
+	return offset / sizeof(payload_pool[0]);
+}
 
 /**
-* @param f  a parameterless function to be created as a process instance
-* @param arg an integer argument to be assigned to this process instanace
-* @param level assigned scheduling level: SYSTEM, PERIODIC or RR
-* @param name assigned PERIODIC process name
-* @return 0 if not successful; otherwise non-zero.
-* @sa Task_GetArg(), PPP[].
-*
-*  A new process  is created to execute the parameterless
-*  function @a f with an initial parameter @a arg, which is retrieved
-*  by a call to Task_GetArg().  If a new process cannot be
-*  created, 0 is returned; otherwise, it returns non-zero.
-*  The created process will belong to its scheduling @a level.
-*  If the process is PERIODIC, then its @a name is a user-specified name
-*  to be used in the PPP[] array. Otherwise, @a name is ignored.
-* @sa @ref policy
+* @brief Drop one reference to a payload block, freeing it with the last. Interrupts must be disabled.
 */
-int Task_Create(void (*f)(void), int arg, unsigned int level, unsigned int name)
+static void payload_drop(uint8_t i)
 {
-	int retval;
+	if(--payload_refs[i] == 0)
+	{
+		/* Nothing waits on the payload pool, so no task needs waking. */
+		pool_put(&payload_blocks, payload_pool[i]);
+	}
+}
+
+void Payload_Release(void* block) {
 	uint8_t sreg;
 	
 	sreg = SREG;
 	Disable_Interrupt();
 	
-	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
-	kernel_request_create_args.arg = arg;
-	kernel_request_create_args.level = (uint8_t)level;
-	kernel_request_create_args.name = (uint8_t)name;
-	
-	kernel_request = TASK_CREATE;
-	enter_kernel();
+	payload_drop(payload_index(block));
 	
-	retval = kernel_request_retval;
 	SREG = sreg;
-	
-	return retval;
 }
 
-
-
-/**
-* @brief The calling task gives up its share of the processor voluntarily.
-*/
-void Task_Next()
-{
-	uint8_t volatile sreg;
+void Service_Publish_Payload( SERVICE *s, void* block ) {
+	uint8_t sreg;
+	uint8_t i;
 	
 	sreg = SREG;
 	Disable_Interrupt();
 	
-	kernel_request = TASK_NEXT;
-	enter_kernel();
+	i = payload_index(block);
+	
+	if(!s->payload)
+	{
+		error_msg = ERR_RUN_10_PAYLOAD_MISUSE;
+		OS_Abort();
+	}
+	
+	if(s->waiting == 0)
+	{
+		/* No subscribers: the block is lost like any value published to nobody. */
+		payload_drop(i);
+	}
+	else
+	{
+		/* The caller's reference passes to the kernel, and from it to the subscribers. */
+		service_publish(s, i, sreg);
+	}
 	
 	SREG = sreg;
 }
 
+void* Service_Subscribe_Payload( SERVICE *s ) {
+	int16_t i;
+	
+	if(!s->payload)
+	{
+		error_msg = ERR_RUN_10_PAYLOAD_MISUSE;
+		OS_Abort();
+	}
+	
+	service_subscribe(s, &i, SERVICE_FOREVER);
+	
+	return payload_pool[i];
+}
 
-/**
-* @brief The calling task terminates itself.
-*/
-void Task_Terminate()
-{
+SEMAPHORE* Semaphore_Init(int16_t count) {
+	SEMAPHORE* s = NULL;
 	uint8_t sreg;
 	
 	sreg = SREG;
 	Disable_Interrupt();
 	
-	kernel_request = TASK_TERMINATE;
-	enter_kernel();
+	if(semaphore_cntr < MAXSEMAPHORE) {
+		s = &semaphores[semaphore_cntr++];
+		s->count = count;
+		s->waiters[0].head = s->waiters[0].tail = NULL;
+		s->waiters[1].head = s->waiters[1].tail = NULL;
+	}
 	
 	SREG = sreg;
+	
+	return s;
 }
 
-
-/** @brief Retrieve the assigned parameter.
-*/
-int Task_GetArg(void)
-{
-	int arg;
+void Semaphore_Take(SEMAPHORE* s) {
 	uint8_t sreg;
 	
 	sreg = SREG;
 	Disable_Interrupt();
 	
-	arg = cur_task->arg;
+	if(s->count > 0)
+	{
+		s->count--;
+	}
+	else
+	{
+		/* Semaphore_Give() hands the unit straight to the waiting task. */
+		kernel_request_semaphore = s;
+		kernel_request = SEMAPHORE_TAKE;
+		enter_kernel();
+	}
 	
 	SREG = sreg;
+}
+
+void Semaphore_Give(SEMAPHORE* s) {
+	uint8_t sreg;
 	
-	return arg;
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	if(s->waiters[0].head == NULL && s->waiters[1].head == NULL)
+	{
+		s->count++;
+	}
+	else if(sreg & _BV(SREG_I))
+	{
+		kernel_request_semaphore = s;
+		kernel_request = SEMAPHORE_GIVE;
+		enter_kernel();
+	}
+	else if(!isr_request(ISR_SEMAPHORE_GIVE, 0, 0, s))
+	{
+		error_msg = ERR_RUN_9_ISR_QUEUE_FULL;
+		OS_Abort();
+	}
+	
+	SREG = sreg;
 }
 
-uint16_t Now() {
-	//Disable interrupts before calcs
-	uint16_t now_time;
-	uint8_t sreg = SREG;
+EVENT_GROUP* Event_Group_Init() {
+	EVENT_GROUP* g = NULL;
+	uint8_t sreg;
+	
+	sreg = SREG;
 	Disable_Interrupt();
 	
-	now_time = running_time * TICK + ((TCNT1 - timer_time)/(F_CPU/TIMER_PRESCALER/1000)); 
+	if(event_group_cntr < MAXEVENTGROUP) {
+		g = &event_groups[event_group_cntr++];
+		g->flags = 0;
+		g->wanted = 0;
+		g->waiters.head = g->waiters.tail = NULL;
+	}
 	
 	SREG = sreg;
 	
-	return now_time;
+	return g;
 }
 
-SERVICE* Service_Init() {
-	//make sure we don't have too many services going
-	if(service_cntr >= MAXSERVICE) {
-		error_msg = ERR_RUN_1_USER_CALLED_OS_ABORT; //create new error message for this
-		OS_Abort();
+void Event_Group_Set(EVENT_GROUP* g, uint16_t bits) {
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	g->flags |= bits;
+	
+	if(bits & g->wanted)
+	{
+		if(sreg & _BV(SREG_I))
+		{
+			kernel_request_group = g;
+			kernel_request = EVENT_SET;
+			enter_kernel();
+		}
+		else if(!isr_request(ISR_EVENT_SET, 0, 0, g))
+		{
+			error_msg = ERR_RUN_9_ISR_QUEUE_FULL;
+			OS_Abort();
+		}
 	}
+	
+	SREG = sreg;
+}
 
-	services[service_cntr].value = 0;
-	services[service_cntr].waiting = 0;
-	services[service_cntr].task_list.head = NULL;
-	services[service_cntr].task_list.tail = NULL;
+void Event_Group_Clear(EVENT_GROUP* g, uint16_t bits) {
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	g->flags &= ~bits;
+	
+	SREG = sreg;
+}
 
-	return &(services[service_cntr++]);
+uint16_t Event_Group_Wait(EVENT_GROUP* g, uint16_t bits, uint8_t mode) {
+	uint16_t flags;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	if(event_satisfied(g->flags, bits, mode))
+	{
+		flags = g->flags;
+		if(mode & EVENT_CLEAR)
+		{
+			g->flags &= ~bits;
+		}
+	}
+	else
+	{
+		cur_task->wait_bits = bits;
+		cur_task->wait_mode = mode;
+		kernel_request_group = g;
+		kernel_request = EVENT_WAIT;
+		enter_kernel();
+		
+		/* kernel_event_check() left the flags that woke the task here. */
+		flags = cur_task->wait_bits;
+	}
+	
+	SREG = sreg;
+	
+	return flags;
 }
 
-void Service_Subscribe( SERVICE *s, int16_t *v ) {
-	//check conditions for subscription
-	if(service_cntr >= MAXSERVICE || cur_task->level == PERIODIC)
-	abort(ERR_RUN_1_USER_CALLED_OS_ABORT);
+/**
+* @brief Chain the blocks of p into its free list. Interrupts must be disabled.
+*/
+static void pool_setup(POOL* p)
+{
+	uint8_t* block = p->storage;
+	uint8_t blocks;
+	
+	p->free = p->blocks > 0 ? p->storage : NULL;
+	for(blocks = p->blocks; blocks > 1; blocks--)
+	{
+		*(void**)block = block + p->size;
+		block += p->size;
+	}
+	if(p->free != NULL)
+	{
+		*(void**)block = NULL;
+	}
+	
+	p->used = 0;
+	p->high_water = 0;
+	p->waiters[0].head = p->waiters[0].tail = NULL;
+	p->waiters[1].head = p->waiters[1].tail = NULL;
+}
 
-	//set task to wait state and add it to publish queue
-	cur_task->state = WAITING;
-	cur_task->value = v;
-	enqueue(&(s->task_list), cur_task);
-	s->waiting++;
-	Task_Next();
+/**
+* @brief Unlink the first free block of p, NULL if none. Interrupts must be disabled.
+*/
+static void* pool_take(POOL* p)
+{
+	void* block = p->free;
+	
+	if(block != NULL)
+	{
+		p->free = *(void**)block;
+		if(++p->used > p->high_water)
+		{
+			p->high_water = p->used;
+		}
+	}
+	
+	return block;
 }
 
-void abort(int msg) {
-	//TODO: need to update error message codes
-	//TODO: add tracing
-	error_msg = msg;
-	OS_Abort();
+/**
+* @brief Link block back in at the head of the free list of p. Interrupts must be disabled.
+*/
+static void pool_put(POOL* p, void* block)
+{
+	*(void**)block = p->free;
+	p->free = block;
+	p->used--;
 }
 
-//this is setup just like the task_terminate
-static void task_interrupt() {
+void Pool_Init(POOL* p) {
 	uint8_t sreg;
+	
 	sreg = SREG;
 	Disable_Interrupt();
-	kernel_request = TASK_INTERRUPT;
-	enter_kernel();
+	
+	pool_setup(p);
+	
 	SREG = sreg;
 }
 
-void Service_Publish( SERVICE *s, int16_t v ) {
-	task_descriptor_t *task = NULL;
-
-	// We don't have any waiting services
-	if(service_cntr == 0 || s == NULL || s->waiting <= 0) {
-		abort(ERR_RUN_1_USER_CALLED_OS_ABORT);
+void* Pool_Alloc(POOL* p) {
+	void* block;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	block = pool_take(p);
+	if(block == NULL && (sreg & _BV(SREG_I)))
+	{
+		/* Pool_Free() hands the block straight to the waiting task. */
+		kernel_request_pool = p;
+		kernel_request = POOL_ALLOC;
+		enter_kernel();
+		
+		block = cur_task->block;
 	}
 	
-	//Since all tasks for this service have the memory address and not the v value,
-	//all we need to do is update the service value
-	s->value = v;
+	SREG = sreg;
 	
-	// Wake up all tasks waiting on the service
-	while((task = dequeue(&(s->task_list))) != NULL) {
-		if(task->state == WAITING) {
-			if(task->level == SYSTEM) {
-				
-				task->state = READY;
-				s->waiting--;
+	return block;
+}
 
-				enqueue(&system_queue, task);
-				
-				//if current task it interruptable, go for it
-				if(cur_task->level != SYSTEM){
-					task_interrupt();
-				}
-			}
-			else if(task->level == RR) {
-				task->state = READY;
-				s->waiting--;
-				
-				enqueue(&rr_queue, task);
-			}
-		}
+void* Pool_TryAlloc(POOL* p) {
+	void* block;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	block = pool_take(p);
+	
+	SREG = sreg;
+	
+	return block;
+}
+
+void Pool_Free(POOL* p, void* block) {
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	if(p->waiters[0].head == NULL && p->waiters[1].head == NULL)
+	{
+		pool_put(p, block);
+	}
+	else if(sreg & _BV(SREG_I))
+	{
+		kernel_request_pool = p;
+		kernel_request_block = block;
+		kernel_request = POOL_FREE;
+		enter_kernel();
 	}
+	else if(!isr_request(ISR_POOL_FREE, 0, (int16_t)(uint16_t)block, p))
+	{
+		error_msg = ERR_RUN_9_ISR_QUEUE_FULL;
+		OS_Abort();
+	}
+	
+	SREG = sreg;
+}
 
+uint8_t Pool_HighWater(POOL* p) {
+	return p->high_water;
 }
 
 /**
@@ -1229,6 +2773,12 @@ int8_t Task_Create_System(void (*f)(void), int16_t arg) {
 	sreg = SREG;
 	Disable_Interrupt();
 
+	/* From an ISR the task is created on the next kernel entry. */
+	if(!(sreg & _BV(SREG_I)))
+	{
+		return isr_request(ISR_CREATE, SYSTEM, arg, (void*)f);
+	}
+
 	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
 	kernel_request_create_args.arg = arg;
 	kernel_request_create_args.level = SYSTEM;
@@ -1286,6 +2836,12 @@ int8_t   Task_Create_RR(void (*f)(void), int16_t arg){
 	sreg = SREG;
 	Disable_Interrupt();
 	
+	/* From an ISR the task is created on the next kernel entry. */
+	if(!(sreg & _BV(SREG_I)))
+	{
+		return isr_request(ISR_CREATE, RR, arg, (void*)f);
+	}
+	
 	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
 	kernel_request_create_args.arg = arg;
 	kernel_request_create_args.level = RR;
@@ -1314,7 +2870,7 @@ void rr(){
 		}else{
 			PORTB = 0;
 		}
-		_delay_ms(10);
+		Task_Sleep(10 / TICK);
 		}
 		Task_Create_System(sys, 0);
 	}
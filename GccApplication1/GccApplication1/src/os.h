@@ -78,20 +78,21 @@ extern "C" {
  *   This task may call Task_Next() before its allowed WCET. The remaining time till the
  *   end of its period is known as its "DELAYED" time.
  *
- *   It is the responsibility of the Application Engineers to ensure that no two PERIODIC
- *   tasks overlapping in execution. It is an \b error if two PERIODIC tasks are ready
- *   at the same time!!!  In other words, from the start of a periodic task until the end
- *   of its wcet, no other periodic task should be scheduled.
+ *   No two PERIODIC tasks may overlap in execution. It is an \b error if two PERIODIC
+ *   tasks are ready at the same time!!!  In other words, from the start of a periodic task
+ *   until the end of its wcet, no other periodic task should be scheduled.
+ *   Task_Create_Periodic() checks this against every PERIODIC task already admitted,
+ *   offsets included, and refuses (returns 0) a task that would ever overlap one of them.
  *
  *   It is an \b error if a PERIODIC task executes longer than the allowed WCET.
  *   All timing violations should be caught and then reported.  The task must call Task_Next()
  *   before the expiry of its WCET.
  *
- *   When a PERIODIC task is preempted, its worst-case execution time will be stretched.
- *   In a similar way, when a RR task is preempted, its allowed quantum will be stretched.
- *   In theory, the RTOS should only accumulate the actual execution time; but in practice,
- *   the actual execution time could only be approximated due to the limitation of the
- *   scheduling timer resolution (1 TICK).
+ *   Each job of a PERIODIC task gets a budget of wcet TICKs of actual execution time.
+ *   The kernel times it with Timer 1's second compare channel (OCR1B) only while the
+ *   task runs, so time spent in preempting tasks or in the kernel is not charged, and an
+ *   overrun is caught at the cycle it happens rather than at the next TICK.
+ *   When a RR task is preempted, its allowed quantum will be stretched.
  *   
  *   It is an error if a PERIODIC task waits on an Event.
  *
@@ -124,6 +125,22 @@ extern "C" {
  *   When a notification is published to a service, all subscribers are immediately woken and receive
  *   the message.  Only the latest notificaton is stored.  If a new notification comes in it overwrites
  *   the previous notification.
+ *
+ *   A queued service, created by Service_Init_Queued(), also keeps the last few notifications in a
+ *   ring, and each subscriber has its own place in it. A subscriber that was busy while values were
+ *   published gets them one per Service_Subscribe() call, without waiting, until it has caught up.
+ *   Only a subscriber that falls a whole ring behind loses values, the oldest ones first.
+ *
+ *   A payload service, created by Service_Init_Payload(), carries a pointer to a block of
+ *   PAYLOAD_SIZE bytes instead of a value, so structures fan out without being copied. The
+ *   publisher fills a block from Payload_Alloc() and publishes it; every subscriber woken gets a
+ *   reference to the same block, which it must give back with Payload_Release() when done. The
+ *   block returns to the pool with the last reference. Subscribers must not write to it.
+ *
+ *   An interrupt handler cannot enter the kernel. A publish from an ISR, recognized by interrupts
+ *   being disabled, is queued instead, and the kernel carries it out as soon as the ISR returns.
+ *   Tasks must therefore not publish with interrupts disabled. Up to ISR_QUEUE_SIZE - 1 requests can
+ *   be outstanding; one more is a runtime error.
  *   
  *   Example:
  *   - A RR task that sends sensor values over a radio subscribes to a service
@@ -183,6 +200,15 @@ extern "C" {
 /** max. number of processes supported */  
 #define MAXPROCESS		8  
 #define MAXSERVICE		8 
+#define MAXSEMAPHORE	8
+#define MAXEVENTGROUP	4
+
+/** values shared by the rings of all queued services \sa Service_Init_Queued() */
+#define SERVICE_RING_POOL	64
+
+/** payload blocks for payload services, and the size of each in bytes \sa Payload_Alloc() */
+#define PAYLOAD_BLOCKS		8
+#define PAYLOAD_SIZE		32
 
 /** workspace size of each process in bytes */ 
 #define WORKSPACE	256
@@ -217,16 +243,105 @@ extern "C" {
 
 #define IDLE     0  
 
+/* notification actions \sa Task_Notify() */
+
+/** OR the value into the task's notification word */
+#define NOTIFY_SET_BITS   0
+/** add one to the notification word, a counting semaphore; the value is ignored */
+#define NOTIFY_INCREMENT  1
+/** replace the notification word with the value */
+#define NOTIFY_OVERWRITE  2
+
+/** timeout of Task_NotifyWait() that never expires */
+#define NOTIFY_FOREVER    0
+
+/* results of Service_Subscribe_Timeout() */
+
+/** no value was published before the timeout */
+#define SERVICE_TIMEOUT   0
+/** a value was received */
+#define SERVICE_RECEIVED  1
+
+/** timeout of Service_Subscribe_Timeout() that never expires */
+#define SERVICE_FOREVER   0
+
+/* event group wait modes \sa Event_Group_Wait() */
+
+/** wake when any of the bits is set */
+#define EVENT_WAIT_ANY    0
+/** wake when all of the bits are set */
+#define EVENT_WAIT_ALL    1
+/** or'ed into the mode: clear the bits waited for on waking */
+#define EVENT_CLEAR       2
+
 
 /*================
   *    T Y P E S
   *================
   */
+/** A task handle
+ * \sa Task_Self(), Task_Notify().
+ */
+typedef struct td_struct TASK;
+
 /** A service descriptor
  * \sa Service_Init().
  */
 typedef struct service SERVICE;  
 
+/** A counting semaphore
+ * \sa Semaphore_Init().
+ */
+typedef struct semaphore SEMAPHORE;
+
+/** A group of 16 event flags
+ * \sa Event_Group_Init().
+ */
+typedef struct event_group EVENT_GROUP;
+
+/** Tasks waiting on a kernel object, first come first served. */
+struct task_queue
+{
+	/** The first waiting task. NULL if none wait. */
+	TASK* head;
+	/** The last waiting task. Undefined if none wait. */
+	TASK* tail;
+};
+
+/** Bytes taken by each block of a pool of \a size byte blocks; a free block holds a pointer. */
+#define POOL_BLOCK_SIZE(size)	((size) < sizeof(void*) ? sizeof(void*) : (size))
+
+/** A pool of fixed-size memory blocks, declared with POOL_DEFINE()
+ * \sa Pool_Init().
+ */
+typedef struct pool
+{
+	/** The blocks, the bytes each takes and how many there are; set by POOL_DEFINE(). */
+	uint8_t* storage;
+	uint16_t size;
+	uint8_t blocks;
+	/** First free block; each free block starts with a pointer to the next. */
+	void* free;
+	/** Blocks in use, and the most ever in use at once. */
+	uint8_t used;
+	uint8_t high_water;
+	/** Waiting SYSTEM tasks, then waiting RR tasks. */
+	struct task_queue waiters[2];
+}
+POOL;
+
+/** Declare the pool \a name of \a blocks blocks of \a size bytes, with its storage.
+ *
+ * The storage and the descriptor come from the one declaration, so their size and
+ * count cannot disagree; a count over 255 fails to build, in C as in C++.
+ * Use it at file scope.
+ * \sa Pool_Init().
+ */
+#define POOL_DEFINE(name, size, blocks) \
+	typedef char name##_blocks_fit_in_uint8[(blocks) <= 255 ? 1 : -1]; \
+	static uint8_t name##_storage[POOL_BLOCK_SIZE(size) * (blocks)]; \
+	static POOL name = { name##_storage, POOL_BLOCK_SIZE(size), (blocks) }
+
 
 /*================
   *    G L O B A L S
@@ -270,6 +385,9 @@ void OS_Abort();
    *  by a call to Task_GetArg().  If a new process cannot be
    *  created, 0 is returned; otherwise, it returns non-zero.
    *
+   *  An ISR may create SYSTEM and RR tasks too. The task is then created when the ISR
+   *  returns, and non-zero only means the request was queued.
+   *
    * \sa \ref policy
    */
 int8_t   Task_Create_System(void (*f)(void), int16_t arg);
@@ -288,6 +406,8 @@ int8_t   Task_Create_RR(    void (*f)(void), int16_t arg);
    *  function \a f with an initial parameter \a arg, which is retrieved
    *  by a call to Task_GetArg().  If a new process cannot be
    *  created, 0 is returned; otherwise, it returns non-zero.
+   *  It cannot be created if \a wcet is 0 or not less than \a period, or if
+   *  any of its jobs would overlap a job of an existing PERIODIC task.
    *
    * \sa \ref policy
    */
@@ -309,6 +429,51 @@ void Task_Next();
   */
 int16_t Task_GetArg();          
 
+/**
+  * \param ticks number of TICKs to sleep
+  *
+  * The calling SYSTEM or RR task is WAITING until \a ticks tick boundaries have
+  * gone by, without using the processor. Task_Sleep(0) is the same as Task_Next().
+  * It is an error for a PERIODIC task to sleep.
+  */
+void Task_Sleep(uint16_t ticks);
+
+/** \return the handle of the calling task, for Task_Notify(). */
+TASK *Task_Self();
+
+/**
+  * \param t the task to notify
+  * \param value bits to set, or the new word, depending on \a action
+  * \param action NOTIFY_SET_BITS, NOTIFY_INCREMENT or NOTIFY_OVERWRITE
+  *
+  * Update the 16-bit notification word of task \a t, and wake it if it is in
+  * Task_NotifyWait() for any of the bits now set. Each task has its own word, so
+  * nothing needs to be allocated. May be called from tasks and ISRs.
+  */
+void Task_Notify(TASK *t, uint16_t value, uint8_t action);
+
+/**
+  * \param mask the bits of the notification word to wait for
+  * \param timeout ticks to wait at most, or NOTIFY_FOREVER
+  * \return the bits of \a mask that were set, which are cleared; 0 on timeout
+  *
+  * Returns at once if any bit of \a mask is already set. With NOTIFY_INCREMENT,
+  * wait with a mask of 0xFFFF to take the whole count. It is an error for a
+  * PERIODIC task to wait.
+  */
+uint16_t Task_NotifyWait(uint16_t mask, uint16_t timeout);
+
+/**
+  * \param last_wake the TICK the task last woke at; set it to Now_Ticks() before the first call
+  * \param period number of TICKs between two wake-ups
+  *
+  * The calling SYSTEM or RR task sleeps until TICK (*last_wake + period), then
+  * *last_wake is advanced by \a period. Unlike a loop around Task_Sleep(), the
+  * wake-ups do not drift with the task's own execution time. Returns at once if
+  * that TICK has already gone by.
+  */
+void Task_Delay_Until(uint16_t *last_wake, uint16_t period);
+
 
   /*=====  Events API ===== */
 
@@ -319,6 +484,28 @@ int16_t Task_GetArg();
  */
 SERVICE *Service_Init();
 
+/**
+ * \param depth number of notifications kept, a power of two
+ * \return a non-NULL SERVICE descriptor if successful; NULL if depth is not a power of two,
+ * MAXSERVICE services exist, or the rings of the queued services would exceed
+ * SERVICE_RING_POOL values.
+ *
+ *  Initialize a new queued SERVICE. Each task that subscribes to it reads the notifications
+ *  published since its first Service_Subscribe() in order, missing none while it is at
+ *  most "depth" behind.
+ */
+SERVICE *Service_Init_Queued(uint8_t depth);
+
+/**
+ * \return a non-NULL SERVICE descriptor if successful; NULL otherwise.
+ *
+ *  Initialize a new payload SERVICE, used with Service_Publish_Payload() and
+ *  Service_Subscribe_Payload(). Using the plain Service_Publish() or a
+ *  Service_Subscribe() call on it, either payload call on another service, or
+ *  a pointer that is not a payload block is ERR_RUN_10_PAYLOAD_MISUSE.
+ */
+SERVICE *Service_Init_Payload();
+
 /**  
   * \param s an Service descriptor
   * \param v pointer to memory where the received value will be written
@@ -326,19 +513,178 @@ SERVICE *Service_Init();
   * The calling task waits for the next published value associated with service "s".
   * More than one task may wait for a service. When a new value "v" is published to
   * "s", all waiting tasks resume and obtain the same value. 
+  * PERIODIC tasks may not wait; OS_Abort() is called with ERR_RUN_8_PERIODIC_WAIT.
+  *
+  * On a queued service the first call only marks where the task starts reading. Later calls
+  * return at once with the next unread value if there is one, and wait otherwise.
   */
 void Service_Subscribe( SERVICE *s, int16_t *v );
 
+/**  
+  * \param s an Service descriptor
+  * \param v pointer to memory where the received value will be written
+  * \param ticks number of TICKs to wait at most, or SERVICE_FOREVER
+  * \return SERVICE_RECEIVED, or SERVICE_TIMEOUT if nothing was published in time
+  *
+  * Like Service_Subscribe(), but gives up after \a ticks tick boundaries. \a v is
+  * not written on timeout. Both the wake-up and the timeout take the task off the
+  * other list in constant time.
+  */
+int8_t Service_Subscribe_Timeout( SERVICE *s, int16_t *v, uint16_t ticks );
+
 
 /**  
   * \param e a Service descriptor
   *
   * The calling task publishes a new value "v" to service "s". All waiting tasks on
   * service "s" will be resumed and receive a copy of this value "v". 
-  * Values generated by services without subscribers will be lost.
+  * Values generated by services without subscribers will be lost, unless the service is queued.
+  * On a queued service the value goes into the ring in constant time, whatever the depth.
+  * All subscribers are woken by one kernel request, so the cost of a publish is
+  * one context switch plus a short loop over the subscribers. If any of them is a
+  * SYSTEM task and the caller is not, the caller is pre-empted once, on return.
   */
 void Service_Publish( SERVICE *s, int16_t v );
 
+/**
+ * \return a block of PAYLOAD_SIZE bytes, or NULL if all PAYLOAD_BLOCKS are in use.
+ *
+ * The caller holds the only reference to the block. Safe to call from ISRs.
+ * The blocks come from a kernel POOL, see Pool_Init().
+ */
+void *Payload_Alloc();
+
+/**
+ * \param block a block from Payload_Alloc() or Service_Subscribe_Payload()
+ *
+ * Drop the caller's reference to the block, which is freed with the last one. Safe to call from ISRs.
+ */
+void Payload_Release( void *block );
+
+/**
+ * \param s a payload Service descriptor
+ * \param block a block from Payload_Alloc()
+ *
+ * Every task waiting on "s" resumes with a reference to "block". The caller's reference
+ * passes to them, so it must not touch the block afterwards. With no subscribers the
+ * block is freed.
+ */
+void Service_Publish_Payload( SERVICE *s, void *block );
+
+/**
+ * \param s a payload Service descriptor
+ * \return the next block published to "s"; release it with Payload_Release().
+ */
+void *Service_Subscribe_Payload( SERVICE *s );
+
+
+  /*=====  Semaphore and Event Group API ===== */
+
+/**
+ * \param count the initial count
+ * \return a non-NULL SEMAPHORE descriptor if successful; NULL if MAXSEMAPHORE are in use.
+ */
+SEMAPHORE *Semaphore_Init(int16_t count);
+
+/**
+ * \param s a semaphore descriptor
+ *
+ * Take one unit of \a s, waiting for a Semaphore_Give() if the count is 0. Waiting
+ * SYSTEM tasks get units before waiting RR tasks, each level first come first served.
+ * It is an error for a PERIODIC task to wait.
+ */
+void Semaphore_Take(SEMAPHORE *s);
+
+/**
+ * \param s a semaphore descriptor
+ *
+ * Give one unit to the first waiting task, or add it to the count. Constant time;
+ * it enters the kernel only to wake a task. May be called from ISRs.
+ */
+void Semaphore_Give(SEMAPHORE *s);
+
+/**
+ * \return a non-NULL EVENT_GROUP descriptor, with no flags set, if successful;
+ * NULL if MAXEVENTGROUP are in use.
+ */
+EVENT_GROUP *Event_Group_Init();
+
+/**
+ * \param g an event group descriptor
+ * \param bits the flags to set
+ *
+ * Set flags and wake every task whose wait they satisfy. Constant time unless a waiting
+ * task wants one of \a bits. May be called from ISRs.
+ */
+void Event_Group_Set(EVENT_GROUP *g, uint16_t bits);
+
+/**
+ * \param g an event group descriptor
+ * \param bits the flags to clear
+ */
+void Event_Group_Clear(EVENT_GROUP *g, uint16_t bits);
+
+/**
+ * \param g an event group descriptor
+ * \param bits the flags to wait for
+ * \param mode EVENT_WAIT_ANY or EVENT_WAIT_ALL, optionally or'ed with EVENT_CLEAR
+ * \return the flags of \a g when the wait was satisfied, before any clearing
+ *
+ * Returns at once if the flags already satisfy the wait. It is an error for a
+ * PERIODIC task to wait.
+ */
+uint16_t Event_Group_Wait(EVENT_GROUP *g, uint16_t bits, uint8_t mode);
+
+
+  /*=====  Memory Pool API ===== */
+
+/**
+ * \param p a pool declared with POOL_DEFINE()
+ *
+ * Chains the blocks of \a p into its free list; call it once, before any task uses \a p.
+ *
+ * Each pool hands out blocks of one size, so it never fragments; use one pool per
+ * size (packets, mailboxes, trace buffers, ...). Free blocks are chained through
+ * their own first bytes, so allocating and freeing are constant time and the pool
+ * needs no memory beyond its storage and descriptor.
+ */
+void Pool_Init(POOL *p);
+
+/**
+ * \param p a pool descriptor
+ * \return a block of \a p, waiting for a Pool_Free() if all are in use
+ *
+ * Waiting SYSTEM tasks get blocks before waiting RR tasks, each level first come
+ * first served. It is an error for a PERIODIC task to wait. Called from an ISR it
+ * does not wait, like Pool_TryAlloc().
+ */
+void *Pool_Alloc(POOL *p);
+
+/**
+ * \param p a pool descriptor
+ * \return a block of \a p, or NULL if all are in use
+ *
+ * Never waits. Safe to call from ISRs.
+ */
+void *Pool_TryAlloc(POOL *p);
+
+/**
+ * \param p the pool descriptor the block came from
+ * \param block a block from Pool_Alloc() or Pool_TryAlloc()
+ *
+ * Hand the block to the first waiting task, or put it back in \a p. Constant time;
+ * it enters the kernel only to wake a task. May be called from ISRs.
+ */
+void Pool_Free(POOL *p, void *block);
+
+/**
+ * \param p a pool descriptor
+ * \return the most blocks of \a p that were ever in use at once
+ *
+ * Compare it with the number of blocks to size pools from real use.
+ */
+uint8_t Pool_HighWater(POOL *p);
+
 
    
   /*=====  System Clock API ===== */
@@ -360,6 +706,12 @@ void Service_Publish( SERVICE *s, int16_t v );
 
 uint16_t Now();  // number of milliseconds since the RTOS boots.
 
+/**
+  * Returns the number of TICKs since OS_Init(). Like Now(), it wraps around
+  * (every 65536 TICKs); see Task_Delay_Until().
+  */
+uint16_t Now_Ticks();
+
 #ifdef __cplusplus
 }
 #endif
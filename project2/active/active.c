@@ -1,4 +1,5 @@
 #include <string.h>
+#include <avr/io.h>
 #include "LED_Test.h"
 /**
  * \file active.c
@@ -24,6 +25,14 @@
  * RTOS scheduling code will alternate lighting of the GREEN LED light on
  * LED D2 and D5 whenever the correspoing PING and PONG tasks are running.
  * (See the file "cswitch.S" for details.)
+ *
+ * \section Active Objects
+ * On top of the tasks sits an active-object layer. An active object owns an
+ * event queue and a run-to-completion handler, and is not a task: a single
+ * dispatcher task calls the handler of the highest-priority object with a
+ * pending event, one event at a time, on its own stack. Events are posted
+ * with AO_Post(), also from ISRs, and the dispatcher takes them without ever
+ * disabling interrupts.
  */
 
 //Comment out the following line to remove debugging code from compiled version.
@@ -33,6 +42,7 @@ typedef void (*voidfuncptr) (void);      /* pointer to void f(void) */
 
 #define WORKSPACE     256
 #define MAXPROCESS   4
+#define MAXACTIVE    8   /* active objects, one per priority 0 .. MAXACTIVE-1 */
 
 
 /*===========
@@ -383,11 +393,171 @@ void Task_Terminate()
    }
 }
 
+/*================
+  * Active Objects
+  *================
+  */
+
+/**
+  * An event: a signal saying what happened and one byte of detail.
+  */
+typedef struct Event
+{
+   unsigned char sig;
+   unsigned char param;
+} EVENT;
+
+struct ActiveObject;
+
+/**
+  * A run-to-completion handler: it must return without waiting for anything.
+  */
+typedef void (*eventhandler) (struct ActiveObject *me, const EVENT *e);
+
+/**
+  * An active object. Its queue is a ring of a power of two events; only
+  * AO_Post() moves "head" and only the dispatcher moves "tail", so each index
+  * has a single writer and a one-byte write is atomic.
+  */
+typedef struct ActiveObject
+{
+   eventhandler handler;
+   EVENT *queue;
+   unsigned char mask;                /* ring size - 1 */
+   volatile unsigned char head;       /* next event to be posted */
+   volatile unsigned char tail;       /* next event to be handled */
+   unsigned char prio;                /* 0 is the lowest */
+} AO;
+
+/**
+  * The started active objects, by priority.
+  */
+static AO *Active[MAXACTIVE];
+
+/**
+  * Start an active object at priority "prio" (one object per priority), with
+  * a queue of "depth" events, a power of two, in "storage".
+  * Returns 0 if "prio" is out of range or already taken, or "depth" is 0 or
+  * not a power of two.
+  */
+unsigned char AO_Start( AO *me, unsigned char prio, eventhandler handler, EVENT *storage, unsigned char depth )
+{
+   if (prio >= MAXACTIVE || Active[prio] != NULL ||
+       depth == 0 || (depth & (depth - 1)) != 0) return 0;
+
+   me->handler = handler;
+   me->queue = storage;
+   me->mask = depth - 1;
+   me->head = 0;
+   me->tail = 0;
+   me->prio = prio;
+   Active[prio] = me;
+   return 1;
+}
+
+/**
+  * Post an event to an active object. Returns 0, dropping the event, if its
+  * queue is full. Safe from ISRs; from a task, interrupts are held off only
+  * while the slot is claimed, so that an ISR posting to the same object
+  * cannot claim it too.
+  */
+unsigned char AO_Post( AO *me, unsigned char sig, unsigned char param )
+{
+   unsigned char sreg = SREG;
+   unsigned char head;
+
+   Disable_Interrupt();
+
+   head = me->head;
+   if ((unsigned char)(head - me->tail) > me->mask) {
+      SREG = sreg;
+      return 0;      /* full */
+   }
+   me->queue[head & me->mask].sig = sig;
+   me->queue[head & me->mask].param = param;
+   me->head = head + 1;    /* publish it to the dispatcher */
+
+   SREG = sreg;
+   return 1;
+}
+
+/**
+  * The dispatcher task. It hands the oldest event of the highest-priority
+  * active object with a pending event to its handler, then looks again, so
+  * an event posted by a handler to a higher-priority object is handled
+  * next. With nothing pending it gives up the processor.
+  */
+void AO_Dispatcher()
+{
+   int prio;
+   AO *ao;
+   EVENT e;
+
+   for(;;) {
+      for (prio = MAXACTIVE - 1; prio >= 0; --prio) {
+         ao = Active[prio];
+         if (ao != NULL && ao->head != ao->tail) break;
+      }
+
+      if (prio < 0) {
+         Task_Next();
+         continue;
+      }
+
+      /* Copy the event out before freeing its slot for the next post. */
+      e = ao->queue[ao->tail & ao->mask];
+      ao->tail = ao->tail + 1;
+      ao->handler( ao, &e );
+   }
+}
+
 /*============
   * A Simple Test 
   *============
   */
 
+/** Signals of the test's events. */
+enum { EV_PING = 1, EV_PONG, EV_ROUND };
+
+static EVENT RoundsQueue[4];
+static EVENT CounterQueue[8];
+
+/** Counts complete Ping-Pong rounds. */
+static AO Rounds;
+
+/** Counts the Ping and Pong turns, and tells Rounds when both have run. */
+static AO Counter;
+
+static unsigned int RoundCount;
+
+/**
+  * Handler of "Counter": a Pong turn after a Ping turn completes a round.
+  */
+void Counter_Handler( AO *me, const EVENT *e )
+{
+   static unsigned char pinged;
+
+   switch(e->sig) {
+   case EV_PING:
+      pinged = 1;
+      break;
+   case EV_PONG:
+      if (pinged) {
+         pinged = 0;
+         AO_Post( &Rounds, EV_ROUND, 0 );   /* higher priority: handled next */
+      }
+      break;
+   }
+}
+
+/**
+  * Handler of "Rounds".
+  */
+void Rounds_Handler( AO *me, const EVENT *e )
+{
+   if (e->sig == EV_ROUND) ++RoundCount;
+}
+
 /**
   * A cooperative "Ping" task.
   * Added testing code for LEDs.
@@ -408,6 +578,7 @@ void Ping()
 	disable_LEDs();  
 	  
     /* printf( "*" );  */
+    AO_Post( &Counter, EV_PING, 0 );
     Task_Next();
   }
 }
@@ -433,6 +604,7 @@ void Pong()
 	disable_LEDs();
 
     /* printf( "." );  */
+    AO_Post( &Counter, EV_PONG, 0 );
     Task_Next();
 	
   }
@@ -440,14 +612,18 @@ void Pong()
 
 
 /**
-  * This function creates two cooperative tasks, "Ping" and "Pong". Both
+  * This function creates two cooperative tasks, "Ping" and "Pong", and the
+  * dispatcher task for the two active objects they post to. All
   * will run forever.
   */
 void main() 
 {
    OS_Init();
+   AO_Start( &Counter, 0, Counter_Handler, CounterQueue, 8 );
+   AO_Start( &Rounds, 1, Rounds_Handler, RoundsQueue, 4 );
    Task_Create( Pong );
    Task_Create( Ping );
+   Task_Create( AO_Dispatcher );
    OS_Start();
 }
 
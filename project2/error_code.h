@@ -53,6 +53,12 @@ ERR_RUN_4_ILLEGAL_ISR_KERNEL_REQUEST,
 /** RTOS Internal error in handling request. */
 ERR_RUN_5_RTOS_INTERNAL_ERROR,
 
+/** A task overwrote the canary at the end of its stack. */
+ERR_RUN_6_STACK_OVERFLOW,
+
+/** A basic task resumed a job that another basic job still sits below on the shared stack. */
+ERR_RUN_7_BASIC_JOB_OUT_OF_ORDER,
+
 };
 
 
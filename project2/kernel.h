@@ -32,6 +32,21 @@ extern "C" {
 /** The number of clock cycles in one "tick" or 5 ms */
 #define TICK_CYCLES     (((F_CPU / TIMER_PRESCALER) / 1000) * TICK)
 
+/** Byte painted over a new task's stack, so its high-water mark can be found later. */
+#define STACK_PAINT     0xA5
+
+/** Word kept at the far (lowest) end of every stack. It is checked each time a task
+ *  leaves the processor unless NO_STACK_CHECK is defined. */
+#define STACK_CANARY    0xC35A
+
+/** Bytes of a new task's initial context: 32 registers, SREG, EIND, and the 3 byte
+ *  addresses of the task's function and of where it returns to. */
+#define TASK_FRAME_SIZE (32 + 2 + 3 + 3)
+
+/** Bytes of a basic job's initial context, popped like a voluntary one: the 18
+ *  call-saved registers, SREG, EIND, and the same two 3 byte addresses. */
+#define JOB_FRAME_SIZE  (18 + 2 + 3 + 3)
+
 /** LEDs for OS_Abort() */
 #define ERROR_LED       6 //PIN 6 OF PORTB = DIGITAL 13 
 
@@ -66,6 +81,18 @@ typedef enum
 }
 kernel_request_t;
 
+/**
+ * @brief The layout of the context saved on a suspended task's stack.
+ */
+typedef enum
+{
+    /** All 32 registers, EIND and SREG, saved by the timer interrupt. */
+    FRAME_FULL = 0,
+    /** Only EIND, SREG and the call-saved registers, saved by enter_kernel(). */
+    FRAME_VOLUNTARY
+}
+frame_t;
+
 
 /**
  * @brief The arguments required to create a task.
@@ -80,20 +107,43 @@ typedef struct
     uint8_t level;
     /** If the new task is PERIODIC, this is its name in the PPP array. */
     uint8_t name;
+    /** Priority inside the SYSTEM or RR level, 0 is the highest. */
+    uint8_t priority;
+    /** Size of the new task's stack in bytes. */
+    uint16_t stack_size;
 }
 create_args_t;
 
 
+/**
+ * @brief CPU time charged to a task or the kernel, in TCNT1 counts.
+ */
+typedef struct
+{
+    /** Counts in total. */
+    uint32_t cycles;
+    /** The value of cycles when the current window began. */
+    uint32_t window_start;
+    /** Counts in the last complete window. */
+    uint32_t window;
+}
+cpu_account_t;
+
+
 typedef struct td_struct task_descriptor_t;
 /**
  * @brief All the data needed to describe the task, including its context.
  */
 struct td_struct
 {
-    /** The stack used by the task. SP points in here when task is RUNNING. */
-    uint8_t                         stack[WORKSPACE];
+    /** The stack used by the task, carved from the stack arena. SP points in here when task is RUNNING. */
+    uint8_t*                        stack;
+    /** Size of the stack in bytes; 0 until the descriptor is first given one. */
+    uint16_t                        stack_size;
     /** A array to save the 17 bit hardware SP into when the task is suspended. */
     volatile uint8_t sp[3];   /* stack pointer into the "workSpace" */
+    /** How the context below sp was saved, so exit_kernel() pops it the same way. */
+    frame_t                         frame;
     /** PERIODIC tasks need a name in the PPP array. */
     uint8_t                         name;
     /** The state of the task in this descriptor. */
@@ -102,6 +152,18 @@ struct td_struct
     int                             arg;
     /** The priority (type) of this task. */
     uint8_t                         level;
+    /** The priority inside its level (SYSTEM and RR only), 0 is the highest. */
+    uint8_t                         priority;
+    /** CPU time this task has used. */
+    cpu_account_t                   cpu;
+    /** Non-zero for a basic task, which runs its jobs on the shared basic stack. */
+    uint8_t                         basic;
+    /** The function a basic task calls for each job. */
+    voidfuncvoid_ptr                job;
+    /** Non-zero while a job of this basic task is on the basic stack. */
+    uint8_t                         job_active;
+    /** The basic job whose frame the current job's frame sits below, NULL if none. */
+    task_descriptor_t*              job_below;
     /** A link to the next task descriptor in the queue holding this task. */
     task_descriptor_t*              next;
 };
@@ -119,6 +181,18 @@ typedef struct
 }
 queue_t;
 
+#if BASIC_STACK < MINSTACK
+#error "BASIC_STACK must hold at least one job's initial context"
+#endif
+
+#if STACK_ARENA < MINSTACK * 2
+#error "STACK_ARENA must hold at least the idle task's stack and one more MINSTACK"
+#endif
+
+#if PRIORITY_LEVELS < 1 || PRIORITY_LEVELS > 8
+#error "PRIORITY_LEVELS must be between 1 and 8, one bit per level in the ready bitmap"
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,10 +12,23 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#ifdef PPP_IN_PROGMEM
+#include <avr/pgmspace.h>
+#endif
 
 #include "os.h"
 #include "kernel.h"
 #include "error_code.h"
+#ifdef KERNEL_TRACE
+#include "trace/trace.h"
+#endif
+
+/** Log a kernel event for trace/trace.h when built with KERNEL_TRACE. */
+#ifdef KERNEL_TRACE
+#define TRACE(type, arg)    trace_event((type), (arg))
+#else
+#define TRACE(type, arg)
+#endif
 
 /* Needed for memset */
 /* #include <string.h> */
@@ -26,6 +39,13 @@ extern "C" int r_main();
 /** PPP and PT defined in user application. */
 extern const unsigned char PPP[];
 
+/** PPP[] is in flash when built with PPP_IN_PROGMEM, e.g. by ppp_schedule.h. */
+#ifdef PPP_IN_PROGMEM
+#define PPP_READ(i)     pgm_read_byte(&PPP[(i)])
+#else
+#define PPP_READ(i)     (PPP[(i)])
+#endif
+
 /** PPP and PT defined in user application. */
 extern const unsigned int PT;
 
@@ -53,11 +73,71 @@ static volatile int kernel_request_retval;
 /** Number of tasks created so far */
 static queue_t dead_pool_queue;
 
-/** The ready queue for RR tasks. Their scheduling is round-robin. */
-static queue_t rr_queue;
+/** All task stacks are carved from here, in order of creation. */
+static uint8_t stack_arena[STACK_ARENA];
+
+/** Bytes of stack_arena carved so far. */
+static uint16_t stack_arena_used = 0;
+
+/** The one stack all basic tasks run their jobs on. */
+static uint8_t basic_stack[BASIC_STACK];
+
+/** The basic task whose job was started last and has not ended, NULL if none. */
+static task_descriptor_t* basic_top = NULL;
+
+/** Coroutines started and not yet ended, in the order they run. */
+static COROUTINE* coroutine_head = NULL;
+static COROUTINE* coroutine_tail = NULL;
+
+/** Non-zero while the RR task running the coroutines exists. */
+static uint8_t coroutine_task = 0;
+
+/** CPU time spent in the kernel. */
+static cpu_account_t kernel_cpu;
+
+/** TCNT1 when cur_task's running time was last charged to it. */
+static uint16_t task_started;
+
+/** TICKs into the current load window. */
+static uint16_t load_ticks = 0;
+
+/** Set once the first load window has ended. */
+static uint8_t load_window_done = 0;
+
+#ifdef JOB_HISTOGRAMS
+/** TICKs since the kernel started; with TCNT1 it makes a 32 bit clock for job times. */
+static uint32_t kernel_ticks = 0;
 
-/** The ready queue for SYSTEM tasks. Their scheduling is first come, first served. */
-static queue_t system_queue;
+/** Job history per PERIODIC name. */
+static JOB_STATS job_stats[MAXNAME + 1];
+
+/** The PERIODIC name whose job is in progress, IDLE if none. PPP slots never overlap. */
+static uint8_t job_name = IDLE;
+
+/** Whether the job in progress has been dispatched yet. */
+static uint8_t job_started;
+
+/** When the job in progress was released. */
+static uint32_t job_release;
+
+/** The task's CPU time when the job in progress was released. */
+static uint32_t job_cycles;
+#endif
+
+/** The ready queues for RR tasks, one per priority. Their scheduling is round-robin. */
+static queue_t rr_queue[PRIORITY_LEVELS];
+
+/** The ready queues for SYSTEM tasks, one per priority. Their scheduling is first come, first served. */
+static queue_t system_queue[PRIORITY_LEVELS];
+
+/** Bit n is set when system_queue[n] is not empty. */
+static uint8_t system_ready_bitmap = 0;
+
+/** Bit n is set when rr_queue[n] is not empty. */
+static uint8_t rr_ready_bitmap = 0;
+
+/** Index of the lowest set bit of a nibble, i.e., the highest ready priority in it. */
+static const uint8_t nibble_first_bit[16] = {0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
 
 /** time remaining in current slot */
 static volatile uint8_t ticks_remaining = 0;
@@ -87,15 +167,32 @@ static void kernel_handle_request(void);
 static void exit_kernel(void) __attribute((noinline, naked));
 static void enter_kernel(void) __attribute((noinline, naked));
 extern "C" void TIMER1_COMPA_vect(void) __attribute__ ((signal, naked));
+extern "C" uint8_t kernel_fast_tick(void) __attribute__ ((used, noinline));
 
 static int kernel_create_task();
+static task_descriptor_t* kernel_take_descriptor(uint16_t stack_size);
+static uint8_t kernel_carve_stack(task_descriptor_t* p, uint16_t stack_size);
 static void kernel_terminate_task(void);
+static void kernel_init_frame(task_descriptor_t* p, uint8_t* stack_bottom, voidfuncvoid_ptr f, voidfuncvoid_ptr on_return);
+static void kernel_init_job_frame(task_descriptor_t* p, uint8_t* stack_bottom, voidfuncvoid_ptr f, voidfuncvoid_ptr on_return);
+static void kernel_start_job(void);
+static void kernel_end_job(void);
 /* queues */
 
 static void enqueue(queue_t* queue_ptr, task_descriptor_t* task_to_add);
 static task_descriptor_t* dequeue(queue_t* queue_ptr);
+static void ready_enqueue(task_descriptor_t* task_to_add);
+static task_descriptor_t* ready_dequeue(uint8_t level);
+static uint8_t highest_priority(uint8_t bitmap);
 
 static void kernel_update_ticker(void);
+static void kernel_check_stack(void);
+static void kernel_roll_window(void);
+static void get_stats(const cpu_account_t* cpu, TASK_STATS* stats);
+#ifdef JOB_HISTOGRAMS
+static uint32_t job_clock(uint16_t now);
+static void job_record(uint16_t* histogram, uint32_t* max, uint32_t value);
+#endif
 static void check_PPP_names(void);
 static void idle (void);
 static void _delay_25ms(void);
@@ -129,15 +226,50 @@ static void idle (void)
  */
 static void kernel_main_loop(void)
 {
+	/* When the kernel last got the processor back. */
+	uint16_t kernel_entered = TCNT1;
+#ifdef KERNEL_TRACE
+	task_descriptor_t* traced_task = NULL;
+#endif
+	
 	for(;;)
 	{
 		kernel_dispatch();
 		
+#ifdef KERNEL_TRACE
+		if(cur_task != traced_task)
+		{
+			TRACE(TRACE_SWITCH, cur_task - task_desc);
+			traced_task = cur_task;
+		}
+#endif
+		
+		task_started = TCNT1;
+		kernel_cpu.cycles += (uint16_t)(task_started - kernel_entered);
+		
+#ifdef JOB_HISTOGRAMS
+		if(!job_started && job_name != IDLE && cur_task->level == PERIODIC)
+		{
+			job_started = 1;
+			job_record(job_stats[job_name].jitter, &job_stats[job_name].max_jitter,
+				job_clock(task_started) - job_release);
+		}
+#endif
+		
 		exit_kernel();
 		
 		/* if this task makes a system call, or is interrupted,
 		 * the thread of control will return to here. */
 		
+		/* The task has been charged at least every TICK, here or by
+		 * kernel_fast_tick(), so the 16 bit difference cannot wrap. */
+		kernel_entered = TCNT1;
+		cur_task->cpu.cycles += (uint16_t)(kernel_entered - task_started);
+		
+#ifndef NO_STACK_CHECK
+		kernel_check_stack();
+#endif
+		
 		kernel_handle_request();
 	}
 }
@@ -159,26 +291,61 @@ static void kernel_dispatch(void)
 	
 	if(cur_task->state != RUNNING || cur_task == idle_task)
 	{
-		if(system_queue.head != NULL)
+#ifdef LEGACY_DISPATCH
+		/* The original single-FIFO-per-level chain, kept for the dispatch benchmark.
+		 * Every task has priority 0 in this build; the bitmaps are not consulted. */
+		if(system_queue[0].head != NULL)
+		{
+			cur_task = dequeue(&system_queue[0]);
+		}
+		else if(!slot_task_finished && PT > 0 && name_to_task_ptr[PPP_READ(slot_name_index)] != NULL)
+		{
+			/* Keep running the current PERIODIC task. */
+			cur_task = name_to_task_ptr[PPP_READ(slot_name_index)];
+		}
+		else if(rr_queue[0].head != NULL)
+		{
+			cur_task = dequeue(&rr_queue[0]);
+		}
+		else
+#else
+		if(system_ready_bitmap)
 		{
-			cur_task = dequeue(&system_queue);
+			cur_task = ready_dequeue(SYSTEM);
 		}
-		else if(!slot_task_finished && PT > 0 && name_to_task_ptr[PPP[slot_name_index]] != NULL)
+		else if(!slot_task_finished && PT > 0 && name_to_task_ptr[PPP_READ(slot_name_index)] != NULL)
 		{
 			/* Keep running the current PERIODIC task. */
-			cur_task = name_to_task_ptr[PPP[slot_name_index]];
+			cur_task = name_to_task_ptr[PPP_READ(slot_name_index)];
 		}
-		else if(rr_queue.head != NULL)
+		else if(rr_ready_bitmap)
 		{
-			cur_task = dequeue(&rr_queue);
+			cur_task = ready_dequeue(RR);
 		}
 		else
+#endif
 		{
 			/* No task available, so idle. */
 			cur_task = idle_task;
 		}
 		
 		cur_task->state = RUNNING;
+		
+		/* A basic task starts a new job each time it is dispatched without one.
+		 * A job it already has must be the last one started, or its stack is
+		 * now in use by the jobs started after it. */
+		if(cur_task->basic)
+		{
+			if(!cur_task->job_active)
+			{
+				kernel_start_job();
+			}
+			else if(cur_task != basic_top)
+			{
+				error_msg = ERR_RUN_7_BASIC_JOB_OUT_OF_ORDER;
+				OS_Abort();
+			}
+		}
 	}
 }
 
@@ -193,6 +360,15 @@ static void kernel_dispatch(void)
  */
 static void kernel_handle_request(void)
 {
+	if(kernel_request == TIMER_EXPIRED)
+	{
+		TRACE(TRACE_TICK, cur_task - task_desc);
+	}
+	else
+	{
+		TRACE(TRACE_SYSCALL, kernel_request);
+	}
+	
 	switch(kernel_request)
 	{
 		case NONE:
@@ -206,7 +382,7 @@ static void kernel_handle_request(void)
 			if(cur_task->level == RR && cur_task->state == RUNNING)
 			{
 				cur_task->state = READY;
-				enqueue(&rr_queue, cur_task);
+				ready_enqueue(cur_task);
 			}
 			break;
 			
@@ -227,7 +403,15 @@ static void kernel_handle_request(void)
 				/* If cur is RR, it might be pre-empted by a new PERIODIC. */
 				if(cur_task->level == RR &&
 					kernel_request_create_args.level == PERIODIC &&
-					PPP[slot_name_index] == kernel_request_create_args.name)
+					PPP_READ(slot_name_index) == kernel_request_create_args.name)
+				{
+					cur_task->state = READY;
+				}
+				
+				/* If cur is RR, it is pre-empted by a new RR of higher priority. */
+				if(cur_task->level == RR &&
+					kernel_request_create_args.level == RR &&
+					kernel_request_create_args.priority < cur_task->priority)
 				{
 					cur_task->state = READY;
 				}
@@ -235,7 +419,7 @@ static void kernel_handle_request(void)
 				/* enqueue READY RR tasks. */
 				if(cur_task->level == RR && cur_task->state == READY)
 				{
-					enqueue(&rr_queue, cur_task);
+					ready_enqueue(cur_task);
 				}
 			}
 			break;
@@ -248,18 +432,34 @@ static void kernel_handle_request(void)
 			break;
 			
 		case TASK_NEXT:
+			if(cur_task->basic)
+			{
+				kernel_end_job();
+			}
+			
 			switch(cur_task->level)
 			{
 				case SYSTEM:
-					enqueue(&system_queue, cur_task);
+				case RR:
+					ready_enqueue(cur_task);
 					break;
 					
 				case PERIODIC:
 					slot_task_finished = 1;
-					break;
-					
-				case RR:
-					enqueue(&rr_queue, cur_task);
+#ifdef JOB_HISTOGRAMS
+					if(job_name == cur_task->name)
+					{
+						job_record(job_stats[job_name].response, &job_stats[job_name].max_response,
+							job_clock(TCNT1) - job_release);
+						job_record(job_stats[job_name].execution, &job_stats[job_name].max_execution,
+							cur_task->cpu.cycles - job_cycles);
+						if(job_stats[job_name].jobs != 0xFFFF)
+						{
+							++job_stats[job_name].jobs;
+						}
+						job_name = IDLE;
+					}
+#endif
 					break;
 					
 				default: /* idle_task */
@@ -386,6 +586,69 @@ static void kernel_handle_request(void)
 "out    0x3c, r31    \n\t"\
 "pop    r31             \n\t"::);
 
+/**
+ * @brief Push EIND, SREG and only the call-saved registers (r2-r17, r28, r29).
+ *
+ * Used where the context is given up by a function call (enter_kernel() and
+ * exit_kernel()): the compiler already treats r0, r18-r27, r30 and r31 as
+ * clobbered across the call and keeps r1 at zero, so they need not be saved.
+ * The frame is 20 bytes instead of the 34 of SAVE_CTX().
+ */
+#define    SAVE_CALLEE_CTX()    asm volatile (\
+"in     r31,0x3c        \n\t"\
+"push   r31             \n\t"\
+"in     r31,__SREG__    \n\t"\
+"cli                    \n\t"\
+"push   r31             \n\t"\
+"push   r29             \n\t"\
+"push   r28             \n\t"\
+"push   r17             \n\t"\
+"push   r16             \n\t"\
+"push   r15             \n\t"\
+"push   r14             \n\t"\
+"push   r13             \n\t"\
+"push   r12             \n\t"\
+"push   r11             \n\t"\
+"push   r10             \n\t"\
+"push   r9              \n\t"\
+"push   r8              \n\t"\
+"push   r7              \n\t"\
+"push   r6              \n\t"\
+"push   r5              \n\t"\
+"push   r4              \n\t"\
+"push   r3              \n\t"\
+"push   r2              \n\t"::);
+
+/**
+ * @brief Pop a frame pushed by SAVE_CALLEE_CTX().
+ *
+ * r1 is cleared before SREG is restored, since clr changes the flags.
+ */
+#define    RESTORE_CALLEE_CTX()    asm volatile (\
+"pop    r2              \n\t"\
+"pop    r3              \n\t"\
+"pop    r4              \n\t"\
+"pop    r5              \n\t"\
+"pop    r6              \n\t"\
+"pop    r7              \n\t"\
+"pop    r8              \n\t"\
+"pop    r9              \n\t"\
+"pop    r10             \n\t"\
+"pop    r11             \n\t"\
+"pop    r12             \n\t"\
+"pop    r13             \n\t"\
+"pop    r14             \n\t"\
+"pop    r15             \n\t"\
+"pop    r16             \n\t"\
+"pop    r17             \n\t"\
+"pop    r28             \n\t"\
+"pop    r29             \n\t"\
+"clr    r1              \n\t"\
+"pop    r31             \n\t"\
+"out    __SREG__, r31    \n\t"\
+"pop    r31             \n\t"\
+"out    0x3c, r31    \n\t"::);
+
 
 /**
  * @fn exit_kernel
@@ -406,30 +669,39 @@ static void exit_kernel(void)
 {
 	/*
 	 * The PC was pushed on the stack with the call to this function.
-	 * Now push on the I/O registers and the SREG as well.
+	 * The kernel always gives up the processor here, by a call, so only
+	 * the call-saved registers, EIND and SREG need to be pushed.
 	 */
-	SAVE_CTX();
+	SAVE_CALLEE_CTX();
 	
 	/*
 	 * The last piece of the context is the SP. Save it to a variable.
 	 * 17 bit stack pointer, stored as EIND (extended indirect register), sp High bits, sp low bits
 	 */
 	kernel_sp[0] = EIND; 
-	kernel_sp[1] = *(&SP + 1);
-	kernel_sp[2] = SP;
+	kernel_sp[1] = SPH;
+	kernel_sp[2] = SPL;
 	
 	/*
 	 * Now restore the task's context, SP first.
 	 * 17 bit stack pointer, stored as EIND (extended indirect register), sp High bits, sp low bits
 	 */
 	EIND = cur_task->sp[0];
-	*(&SP + 1) = cur_task->sp[1];
-	SP = (uint16_t)(cur_task->sp);
+	SPH = cur_task->sp[1];
+	SPL = cur_task->sp[2];
 	
 	/*
-	 * Now restore I/O and SREG registers.
+	 * Now restore I/O and SREG registers, using the frame layout the
+	 * task was saved with.
 	 */
-	RESTORE_CTX();
+	if(cur_task->frame == FRAME_VOLUNTARY)
+	{
+		RESTORE_CALLEE_CTX();
+	}
+	else
+	{
+		RESTORE_CTX();
+	}
 	
 	/*
 	 * return explicitly required as we are "naked".
@@ -457,30 +729,32 @@ static void enter_kernel(void)
 {
 	/*
 	 * The PC was pushed on the stack with the call to this function.
-	 * Now push on the I/O registers and the SREG as well.
+	 * The task is making a system call, so only the call-saved registers,
+	 * EIND and SREG need to be pushed.
 	 */
-	SAVE_CTX();
+	SAVE_CALLEE_CTX();
 	
 	/*
 	 * The last piece of the context is the SP. Save it to a variable.
 	 * 17 bit stack pointer, stored as EIND (extended indirect register), sp High bits, sp low bits
 	 */
 	cur_task->sp[0] = EIND;
-	cur_task->sp[1] =  *(&SP +1);
-	cur_task->sp[2] = SP;
+	cur_task->sp[1] = SPH;
+	cur_task->sp[2] = SPL;
+	cur_task->frame = FRAME_VOLUNTARY;
 	
 	/*
 	 * Now restore the kernel's context, SP first.
 	 * 17 bit stack pointer, stored as EIND (extended indirect register), sp High bits, sp low bits
 	 */
-	EIND = kernel_sp[1];
-	*(&SP + 1) = kernel_sp[1];
-	SP = kernel_sp[2];
+	EIND = kernel_sp[0];
+	SPH = kernel_sp[1];
+	SPL = kernel_sp[2];
 	
 	/*
 	 * Now restore I/O and SREG registers.
 	 */
-	RESTORE_CTX();
+	RESTORE_CALLEE_CTX();
 	
 	/*
 	 * return explicitly required as we are "naked".
@@ -492,12 +766,126 @@ static void enter_kernel(void)
 }
 
 
+/**
+ * @brief Call kernel_fast_tick() on the interrupted task's stack, saving only
+ * what the compiler may clobber: r0, r1, r18-r27, r30, r31 and SREG.
+ *
+ * If it handled the tick, return to the task straight away with reti.
+ * Otherwise put everything back as it was on entry (interrupts still
+ * disabled) and fall through to the full context switch into the kernel.
+ * The result is tested before the pops, which leave the flags alone, and
+ * acted on before SREG is restored.
+ */
+#define    FAST_TICK()    asm volatile (\
+"push   r0              \n\t"\
+"in     r0,__SREG__     \n\t"\
+"push   r0              \n\t"\
+"push   r1              \n\t"\
+"clr    r1              \n\t"\
+"push   r18             \n\t"\
+"push   r19             \n\t"\
+"push   r20             \n\t"\
+"push   r21             \n\t"\
+"push   r22             \n\t"\
+"push   r23             \n\t"\
+"push   r24             \n\t"\
+"push   r25             \n\t"\
+"push   r26             \n\t"\
+"push   r27             \n\t"\
+"push   r30             \n\t"\
+"push   r31             \n\t"\
+"call   kernel_fast_tick\n\t"\
+"tst    r24             \n\t"\
+"pop    r31             \n\t"\
+"pop    r30             \n\t"\
+"pop    r27             \n\t"\
+"pop    r26             \n\t"\
+"pop    r25             \n\t"\
+"pop    r24             \n\t"\
+"pop    r23             \n\t"\
+"pop    r22             \n\t"\
+"pop    r21             \n\t"\
+"pop    r20             \n\t"\
+"pop    r19             \n\t"\
+"pop    r18             \n\t"\
+"pop    r1              \n\t"\
+"breq   1f              \n\t"\
+"pop    r0              \n\t"\
+"out    __SREG__, r0    \n\t"\
+"pop    r0              \n\t"\
+"reti                   \n\t"\
+"1:                     \n\t"\
+"pop    r0              \n\t"\
+"out    __SREG__, r0    \n\t"\
+"pop    r0              \n\t"::);
+
+
+/**
+ * @brief The part of a tick that can be handled without entering the kernel.
+ *
+ * Called by TIMER1_COMPA_vect on the interrupted task's stack. If this tick
+ * cannot change the dispatch decision, do its bookkeeping, schedule the next
+ * tick and return 1: the task simply resumes. Return 0, touching nothing, if
+ * the kernel has to run. That is when:
+ *  - the current PPP slot ends on this tick,
+ *  - the running RR task's quantum ends and another RR task of the same or
+ *    higher priority is ready,
+ *  - the load window ends (kernel_roll_window() needs the kernel's accounts).
+ * A PERIODIC task in mid-slot, a lone RR task, a SYSTEM task and the idle task
+ * keep the processor without a context switch.
+ */
+uint8_t kernel_fast_tick(void)
+{
+	uint16_t now;
+	
+	if(PT > 0 && ticks_remaining <= 1)
+	{
+		return 0;
+	}
+	
+	if(load_ticks + 1 >= LOAD_WINDOW)
+	{
+		return 0;
+	}
+	
+#ifdef LEGACY_DISPATCH
+	if(cur_task->level == RR && rr_queue[0].head != NULL)
+#else
+	if(cur_task->level == RR && (rr_ready_bitmap & ((2 << cur_task->priority) - 1)))
+#endif
+	{
+		return 0;
+	}
+	
+	if(PT > 0)
+	{
+		--ticks_remaining;
+	}
+	++load_ticks;
+#ifdef JOB_HISTOGRAMS
+	++kernel_ticks;
+#endif
+	TRACE(TRACE_TICK, cur_task - task_desc);
+	
+	/* The task may keep the processor for many ticks, longer than a 16 bit
+	 * count of TCNT1 can span, so charge it the time so far on each one. */
+	now = TCNT1;
+	cur_task->cpu.cycles += (uint16_t)(now - task_started);
+	task_started = now;
+	
+	OCR1A += TICK_CYCLES;
+	
+	return 1;
+}
+
+
 /**
  * @fn TIMER1_COMPA_vect
  *
  * @brief The interrupt handler for output compare interrupts on Timer 1
  *
- * Used to enter the kernel when a tick expires.
+ * Used to enter the kernel when a tick expires, unless kernel_fast_tick()
+ * finds that the kernel would only let the interrupted task carry on.
  *
  * Assumption: We are still executing on the cur_task stack.
  * The return address inside the current task code is on the top of the stack.
@@ -509,6 +897,8 @@ static void enter_kernel(void)
 void TIMER1_COMPA_vect(void)
 {
 	//PORTB ^= _BV(PB7);		// Arduino LED
+	FAST_TICK();
+	
 	/*
 	 * Save the interrupted task's context on its stack,
 	 * and save the stack pointer.
@@ -526,13 +916,21 @@ void TIMER1_COMPA_vect(void)
 	
 	SAVE_CTX_BOTTOM();
 	
+	/*
+	 * The task may have been interrupted with r1 in use (e.g. by a mul).
+	 * It is saved now, and the C code below needs it to be zero: the
+	 * FRAME_FULL tag stored next is written from r1.
+	 */
+	asm volatile ("clr r1\n\t"::);
+	
 	/*
 	 * Save the tasks stack pointer
 	 * 17 bit stack pointer, stored as EIND (extended indirect register), sp High bits, sp low bits
 	 */
 	cur_task->sp[0] = EIND;
-	cur_task->sp[1] = *(&SP + 1);
-	cur_task->sp[2] = SP;
+	cur_task->sp[1] = SPH;
+	cur_task->sp[2] = SPL;
+	cur_task->frame = FRAME_FULL;
 	
 	/*
 	 * Now that we already saved a copy of the stack pointer
@@ -540,8 +938,8 @@ void TIMER1_COMPA_vect(void)
 	 * the kernel stack and use it. We will restore it again later.
 	 */
 	EIND = kernel_sp[0];
-	*(&SP + 1) = kernel_sp[1];
-	SP = kernel_sp[2];
+	SPH = kernel_sp[1];
+	SPL = kernel_sp[2];
 	
 	/*
 	 * Inform the kernel that this task was interrupted.
@@ -558,13 +956,15 @@ void TIMER1_COMPA_vect(void)
 	 * 17 bit stack pointer, stored as EIND (extended indirect register), sp High bits, sp low bits
 	 */
 	EIND = kernel_sp[0];
-	*(&SP + 1) = kernel_sp[1];
-	SP = kernel_sp[2];
+	SPH = kernel_sp[1];
+	SPL = kernel_sp[2];
 	
 	/*
-	 * Now restore I/O and SREG registers.
+	 * Now restore I/O and SREG registers. The kernel was saved by
+	 * exit_kernel(), so its frame is the reduced one; this also clears r1,
+	 * which the interrupted task may have been using.
 	 */
-	RESTORE_CTX();
+	RESTORE_CALLEE_CTX();
 	
 	/*
 	 * We use "ret" here, not "reti", because we do not want to
@@ -593,7 +993,7 @@ static int kernel_create_task()
 {
 	/* The new task. */
 	task_descriptor_t *p;
-	uint8_t* stack_bottom;
+	uint16_t i;
 	
 	
 	if (dead_pool_queue.head == NULL)
@@ -602,6 +1002,20 @@ static int kernel_create_task()
 		return 0;
 	}
 	
+	if(kernel_request_create_args.stack_size == 0)
+	{
+		/* Basic tasks run to completion, which only SYSTEM and PERIODIC jobs are scheduled to do. */
+		if(kernel_request_create_args.level != SYSTEM && kernel_request_create_args.level != PERIODIC)
+		{
+			return 0;
+		}
+	}
+	else if(kernel_request_create_args.stack_size < MINSTACK)
+	{
+		/* Not even room for the initial context. */
+		return 0;
+	}
+	
 	if(kernel_request_create_args.level == PERIODIC &&
 		(kernel_request_create_args.name == IDLE ||
 		kernel_request_create_args.name > MAXNAME))
@@ -630,25 +1044,96 @@ static int kernel_create_task()
 	if(kernel_request_create_args.level == NULL)
 	{
 		p = &task_desc[MAXPROCESS];
+		kernel_carve_stack(p, kernel_request_create_args.stack_size);
 	}
-	/* Find an unused descriptor. */
+	/* Find an unused descriptor with a big enough stack. */
 	else
 	{
-		p = dequeue(&dead_pool_queue);
+		p = kernel_take_descriptor(kernel_request_create_args.stack_size);
+		if(p == NULL)
+		{
+			/* Out of stack space. */
+			return 0;
+		}
+	}
+	
+	p->basic = kernel_request_create_args.stack_size == 0;
+	p->job_active = 0;
+	p->job = kernel_request_create_args.f;
+	
+	/* A basic task gets its stack and initial context when each job starts. */
+	if(!p->basic)
+	{
+		/* Paint the stack for Task_StackHighWater(), with the canary at its far end. */
+		for(i = 2; i < p->stack_size; ++i)
+		{
+			p->stack[i] = STACK_PAINT;
+		}
+		p->stack[0] = (uint8_t)STACK_CANARY;
+		p->stack[1] = (uint8_t)(STACK_CANARY >> 8);
+		
+		kernel_init_frame(p, &(p->stack[p->stack_size - 1]), p->job, Task_Terminate);
+	}
+	
+	p->cpu.cycles = 0;
+	p->cpu.window_start = 0;
+	p->cpu.window = 0;
+	
+	p->state = READY;
+	p->arg = kernel_request_create_args.arg;
+	p->level = kernel_request_create_args.level;
+	p->name = kernel_request_create_args.name;
+#ifdef LEGACY_DISPATCH
+	p->priority = 0;
+#else
+	p->priority = kernel_request_create_args.priority;
+#endif
+	
+	TRACE(TRACE_CREATE, (p->level << 4) | (p - task_desc));
+	
+	switch(kernel_request_create_args.level)
+	{
+		case PERIODIC:
+			/* Put this newly created PPP task into the PPP lookup array */
+			name_to_task_ptr[kernel_request_create_args.name] = p;
+			break;
+			
+		case SYSTEM:
+		case RR:
+			/* Put SYSTEM and Round Robin tasks on a ready queue. */
+			ready_enqueue(p);
+			break;
+			
+		default:
+			/* idle task does not go in a queue */
+			break;
 	}
 	
-	stack_bottom = &(p->stack[WORKSPACE-1]);
 	
+	return 1;
+}
+
+
+/**
+ * @brief Lay out a task's initial context, as if it had been interrupted right before f.
+ *
+ * @param p the task
+ * @param stack_bottom the highest byte of the stack the context goes on
+ * @param f the function the task starts in
+ * @param on_return where f returns to
+ */
+static void kernel_init_frame(task_descriptor_t* p, uint8_t* stack_bottom, voidfuncvoid_ptr f, voidfuncvoid_ptr on_return)
+{
 	/* The stack grows down in memory, so the stack pointer is going to end up
-	 * pointing to the location 32 + 1 + 2 + 2 = 37 bytes above the bottom, to make
+	 * pointing to the location TASK_FRAME_SIZE = 40 bytes above the bottom, to make
 	 * room for (from bottom to top):
-	 *   the address of Task_Terminate() to destroy the task if it ever returns,
-	 *   the address of the start of the task to "return" to the first time it runs,
-	 *   register 31,
+	 *   the 3 byte address of on_return, e.g. Task_Terminate() to destroy the task if it ever returns,
+	 *   the 3 byte address of the start of the task to "return" to the first time it runs,
+	 *   register 31 and EIND,
 	 *   the stored SREG, and
 	 *   registers 30 to 0.
 	 */
-	uint8_t* stack_top = stack_bottom - (32 + 1 + 2 + 2);
+	uint8_t* stack_top = stack_bottom - TASK_FRAME_SIZE;
 	
 	/* Not necessary to clear the task descriptor. */
 	/* memset(p,0,sizeof(task_descriptor_t)); */
@@ -668,12 +1153,12 @@ static int kernel_create_task()
 	 * second), even though the AT90 is LITTLE ENDIAN machine.
 	 */
 	stack_top[35] = 0; //EIND
-	stack_top[36] = (uint8_t)((uint16_t)(kernel_request_create_args.f) >> 8);
-	stack_top[37] = (uint8_t)(uint16_t)(kernel_request_create_args.f);
+	stack_top[36] = (uint8_t)((uint16_t)(f) >> 8);
+	stack_top[37] = (uint8_t)(uint16_t)(f);
 	
 	stack_top[38] = 0; //EIND
-	stack_top[39] = (uint8_t)((uint16_t)Task_Terminate >> 8);
-	stack_top[40] = (uint8_t)(uint16_t)Task_Terminate;
+	stack_top[39] = (uint8_t)((uint16_t)on_return >> 8);
+	stack_top[40] = (uint8_t)(uint16_t)on_return;
 	
 	/*
 	 * Make stack pointer point to cell above stack (the top).
@@ -683,34 +1168,101 @@ static int kernel_create_task()
 	p->sp[0] = 0; //EIND
 	p->sp[1] = (uint8_t) ((uint16_t) stack_top >> 8);
 	p->sp[2] = (uint8_t) (uint16_t)stack_top;
+	/* The initial context above is a full one. */
+	p->frame = FRAME_FULL;
+}
+
+
+/**
+ * @brief Take a descriptor out of the dead pool, with a stack of at least stack_size bytes.
+ *
+ * A descriptor whose old stack is big enough is reused as is. Otherwise a new
+ * stack is carved for a descriptor that has none yet, or whose stack is the
+ * last one carved (so it can grow in place); failing both, for the head of
+ * the dead pool. The arena only grows at its end, so that descriptor's old
+ * stack is then leaked: its bytes stay carved until the next reset.
+ *
+ * @return the descriptor, or NULL if the arena has no room for the stack.
+ */
+static task_descriptor_t* kernel_take_descriptor(uint16_t stack_size)
+{
+	task_descriptor_t* prev = NULL;
+	task_descriptor_t* p = dead_pool_queue.head;
 	
-	p->state = READY;
-	p->arg = kernel_request_create_args.arg;
-	p->level = kernel_request_create_args.level;
-	p->name = kernel_request_create_args.name;
+	while(p != NULL && p->stack_size < stack_size)
+	{
+		prev = p;
+		p = p->next;
+	}
 	
-	switch(kernel_request_create_args.level)
+	if(p == NULL)
 	{
-		case PERIODIC:
-			/* Put this newly created PPP task into the PPP lookup array */
-			name_to_task_ptr[kernel_request_create_args.name] = p;
-			break;
-			
-		case SYSTEM:
-			/* Put SYSTEM and Round Robin tasks on a queue. */
-			enqueue(&system_queue, p);
-			break;
-			
-		case RR:
-			/* Put SYSTEM and Round Robin tasks on a queue. */
-			enqueue(&rr_queue, p);
-			break;
-			
-		default:
-			/* idle task does not go in a queue */
-			break;
+		prev = NULL;
+		p = dead_pool_queue.head;
+		while(p != NULL && p->stack_size != 0 &&
+			p->stack + p->stack_size != &stack_arena[stack_arena_used])
+		{
+			prev = p;
+			p = p->next;
+		}
+		
+		if(p == NULL)
+		{
+			/* Its old stack is not at the end of the arena, so it cannot be
+			 * given back; it is leaked. */
+			prev = NULL;
+			p = dead_pool_queue.head;
+		}
+		
+		if(!kernel_carve_stack(p, stack_size))
+		{
+			return NULL;
+		}
+	}
+	
+	/* Unlink it from the dead pool. */
+	if(prev == NULL)
+	{
+		dead_pool_queue.head = p->next;
+	}
+	else
+	{
+		prev->next = p->next;
+	}
+	if(dead_pool_queue.tail == p)
+	{
+		dead_pool_queue.tail = prev;
+	}
+	p->next = NULL;
+	
+	return p;
+}
+
+
+/**
+ * @brief Give a descriptor a new stack of stack_size bytes from the arena.
+ *
+ * If its old stack is the last one carved, the new one starts in its place.
+ *
+ * @return 1 on success, 0 if the arena is full (the old stack is kept).
+ */
+static uint8_t kernel_carve_stack(task_descriptor_t* p, uint16_t stack_size)
+{
+	uint16_t top = stack_arena_used;
+	
+	if(p->stack_size != 0 && p->stack + p->stack_size == &stack_arena[top])
+	{
+		top -= p->stack_size;
 	}
 	
+	if(stack_size > STACK_ARENA - top)
+	{
+		return 0;
+	}
+	
+	p->stack = &stack_arena[top];
+	p->stack_size = stack_size;
+	stack_arena_used = top + stack_size;
 	
 	return 1;
 }
@@ -722,14 +1274,145 @@ static int kernel_create_task()
 static void kernel_terminate_task(void)
 {
 	/* deallocate all resources used by this task */
+	TRACE(TRACE_EXIT, cur_task - task_desc);
 	cur_task->state = DEAD;
 	if(cur_task->level == PERIODIC)
 	{
 		name_to_task_ptr[cur_task->name] = NULL;
 	}
+	if(cur_task->basic && cur_task->job_active)
+	{
+		kernel_end_job();
+	}
 	enqueue(&dead_pool_queue, cur_task);
 }
 
+
+/**
+ * @brief Lay out a basic job's initial context, as if it had entered the kernel right before f.
+ *
+ * The job needs no register values, so the call-saved registers are left as
+ * whatever is on the stack; exit_kernel() clears r1 and sets SREG.
+ *
+ * @param p the basic task
+ * @param stack_bottom the highest byte of the basic stack the context goes on
+ * @param f the job's function
+ * @param on_return where f returns to
+ */
+static void kernel_init_job_frame(task_descriptor_t* p, uint8_t* stack_bottom, voidfuncvoid_ptr f, voidfuncvoid_ptr on_return)
+{
+	uint8_t* stack_top = stack_bottom - JOB_FRAME_SIZE;
+	
+	/* stack_top[0] is the byte above the stack.
+	 * stack_top[1] to stack_top[18] are r2 to r17, r28 and r29. */
+	stack_top[19] = (uint8_t) _BV(SREG_I); /* set SREG_I bit in stored SREG. */
+	stack_top[20] = 0; /* EIND */
+	
+	/* Return addresses, most significant byte first, as in kernel_init_frame(). */
+	stack_top[21] = 0; //EIND
+	stack_top[22] = (uint8_t)((uint16_t)(f) >> 8);
+	stack_top[23] = (uint8_t)(uint16_t)(f);
+	
+	stack_top[24] = 0; //EIND
+	stack_top[25] = (uint8_t)((uint16_t)on_return >> 8);
+	stack_top[26] = (uint8_t)(uint16_t)on_return;
+	
+	p->sp[0] = 0; //EIND
+	p->sp[1] = (uint8_t) ((uint16_t) stack_top >> 8);
+	p->sp[2] = (uint8_t) (uint16_t)stack_top;
+	p->frame = FRAME_VOLUNTARY;
+}
+
+
+/**
+ * @brief Start a job of the current basic task below the innermost job already on the basic stack.
+ *
+ * The job begins with a fresh initial context in the voluntary layout, so
+ * exit_kernel() only pops the call-saved registers before "returning" into
+ * the job as if calling it. A PERIODIC job returns into Task_Next() to wait
+ * for its next slot, a SYSTEM one into Task_Terminate().
+ */
+static void kernel_start_job(void)
+{
+	uint8_t* stack_bottom = &basic_stack[BASIC_STACK - 1];
+	
+	if(basic_top != NULL)
+	{
+		/* The saved stack pointer is the first free byte below the preempted job. */
+		stack_bottom = (uint8_t*)(((uint16_t)basic_top->sp[1] << 8) | basic_top->sp[2]);
+	}
+	
+	/* Keep the initial context clear of the canary: the lowest byte written
+	 * is stack_bottom - JOB_FRAME_SIZE + 1. */
+	if(stack_bottom - JOB_FRAME_SIZE + 1 < &basic_stack[sizeof(uint16_t)])
+	{
+		error_msg = ERR_RUN_6_STACK_OVERFLOW;
+		OS_Abort();
+	}
+	
+	kernel_init_job_frame(cur_task, stack_bottom, cur_task->job,
+		cur_task->level == PERIODIC ? Task_Next : Task_Terminate);
+	
+	cur_task->job_below = basic_top;
+	cur_task->job_active = 1;
+	basic_top = cur_task;
+}
+
+
+/**
+ * @brief End the job of the current basic task, giving its part of the basic stack back.
+ */
+static void kernel_end_job(void)
+{
+	if(cur_task != basic_top)
+	{
+		error_msg = ERR_RUN_5_RTOS_INTERNAL_ERROR;
+		OS_Abort();
+	}
+	
+	basic_top = cur_task->job_below;
+	cur_task->job_active = 0;
+}
+
+/**
+ * @brief Abort if the task that just left the processor overwrote its stack canary.
+ *
+ * Only the far end of the stack is checked, so an overflow that jumps past
+ * the canary without writing it goes unnoticed.
+ */
+static void kernel_check_stack(void)
+{
+	uint8_t* stack = cur_task->basic ? basic_stack : cur_task->stack;
+	
+	if(stack[0] != (uint8_t)STACK_CANARY ||
+		stack[1] != (uint8_t)(STACK_CANARY >> 8))
+	{
+		error_msg = ERR_RUN_6_STACK_OVERFLOW;
+		OS_Abort();
+	}
+}
+
+/**
+ * @brief End the current load window: each account's counts since its start become its window.
+ */
+static void kernel_roll_window(void)
+{
+	uint8_t i;
+	cpu_account_t* cpu;
+	
+	for(i = 0; i <= MAXPROCESS; ++i)
+	{
+		cpu = &task_desc[i].cpu;
+		cpu->window = cpu->cycles - cpu->window_start;
+		cpu->window_start = cpu->cycles;
+	}
+	
+	kernel_cpu.window = kernel_cpu.cycles - kernel_cpu.window_start;
+	kernel_cpu.window_start = kernel_cpu.cycles;
+	
+	load_window_done = 1;
+}
+
 /*
  * Queue manipulation.
  */
@@ -779,6 +1462,84 @@ static task_descriptor_t* dequeue(queue_t* queue_ptr)
 }
 
 
+/**
+ * @brief Add a SYSTEM or RR task to the back of the ready queue for its priority.
+ *
+ * @param task_to_add the task descriptor to add
+ */
+static void ready_enqueue(task_descriptor_t* task_to_add)
+{
+	uint8_t bit = _BV(task_to_add->priority);
+	
+	if(task_to_add->level == SYSTEM)
+	{
+		enqueue(&system_queue[task_to_add->priority], task_to_add);
+		system_ready_bitmap |= bit;
+	}
+	else
+	{
+		enqueue(&rr_queue[task_to_add->priority], task_to_add);
+		rr_ready_bitmap |= bit;
+	}
+}
+
+
+/**
+ * @brief Pops the highest priority ready task of a level.
+ *
+ * @param level SYSTEM or RR
+ * @return the popped task descriptor, NULL if no task of that level is ready
+ */
+static task_descriptor_t* ready_dequeue(uint8_t level)
+{
+	queue_t* queues;
+	uint8_t* bitmap;
+	task_descriptor_t* task_ptr;
+	uint8_t priority;
+	
+	if(level == SYSTEM)
+	{
+		queues = system_queue;
+		bitmap = &system_ready_bitmap;
+	}
+	else
+	{
+		queues = rr_queue;
+		bitmap = &rr_ready_bitmap;
+	}
+	
+	if(*bitmap == 0)
+	{
+		return NULL;
+	}
+	
+	priority = highest_priority(*bitmap);
+	task_ptr = dequeue(&queues[priority]);
+	
+	if(queues[priority].head == NULL)
+	{
+		*bitmap &= ~_BV(priority);
+	}
+	
+	return task_ptr;
+}
+
+
+/**
+ * @brief Highest priority (lowest bit number) set in a non-empty ready bitmap.
+ *
+ * Two table lookups at most, whatever the number of ready tasks.
+ */
+static uint8_t highest_priority(uint8_t bitmap)
+{
+	if(bitmap & 0x0F)
+	{
+		return nibble_first_bit[bitmap & 0x0F];
+	}
+	return 4 + nibble_first_bit[bitmap >> 4];
+}
+
+
 /**
  * @brief Update the current time.
  *
@@ -786,16 +1547,32 @@ static task_descriptor_t* dequeue(queue_t* queue_ptr)
  */
 static void kernel_update_ticker(void)
 {
+	task_descriptor_t* slot_task;
+	
 	/* PORTD ^= LED_D5_RED; */
 	
+#ifdef JOB_HISTOGRAMS
+	++kernel_ticks;
+#endif
+	
+	if(++load_ticks == LOAD_WINDOW)
+	{
+		load_ticks = 0;
+		kernel_roll_window();
+	}
+	
 	if(PT > 0)
 	{
 		--ticks_remaining;
 		
 		if(ticks_remaining == 0)
 		{
-			/* If Periodic task still running then error */
-			if(cur_task != NULL && cur_task->level == PERIODIC && slot_task_finished == 0)
+			slot_task = name_to_task_ptr[PPP_READ(slot_name_index)];
+			
+			/* If Periodic task still running then error. A basic one may not
+			 * even be preempted, as the next slot's job would start below it. */
+			if((cur_task != NULL && cur_task->level == PERIODIC && slot_task_finished == 0) ||
+				(slot_task != NULL && slot_task->job_active))
 			{
 				/* error handling */
 				error_msg = ERR_RUN_3_PERIODIC_TOOK_TOO_LONG;
@@ -808,15 +1585,26 @@ static void kernel_update_ticker(void)
 				slot_name_index = 0;
 			}
 			
-			ticks_remaining = PPP[slot_name_index + 1];
+			ticks_remaining = PPP_READ(slot_name_index + 1);
+			TRACE(TRACE_SLOT, PPP_READ(slot_name_index));
 			
-			if(PPP[slot_name_index] == IDLE || name_to_task_ptr[PPP[slot_name_index]] == NULL)
+			if(PPP_READ(slot_name_index) == IDLE || name_to_task_ptr[PPP_READ(slot_name_index)] == NULL)
 			{
 				slot_task_finished = 1;
+#ifdef JOB_HISTOGRAMS
+				job_name = IDLE;
+#endif
 			}
 			else
 			{
 				slot_task_finished = 0;
+#ifdef JOB_HISTOGRAMS
+				/* The job is released at this tick, which happened at OCR1A - TICK_CYCLES. */
+				job_name = PPP_READ(slot_name_index);
+				job_started = 0;
+				job_release = kernel_ticks * TICK_CYCLES;
+				job_cycles = name_to_task_ptr[job_name]->cpu.cycles;
+#endif
 			}
 		}
 	}
@@ -833,7 +1621,7 @@ static void check_PPP_names(void)
 	
 	for(i = 0; i < 2 * PT; i += 2)
 	{
-		name = PPP[i];
+		name = PPP_READ(i);
 		
 		/* name == IDLE or 0 < name <= MAXNAME */
 		if(name <= MAXNAME)
@@ -898,25 +1686,36 @@ void OS_Init()
 	dead_pool_queue.head = &task_desc[0];
 	dead_pool_queue.tail = &task_desc[MAXPROCESS - 1];
 	
+	/* Paint the basic stack, with its canary at the far end. */
+	for(i = 2; i < BASIC_STACK; ++i)
+	{
+		basic_stack[i] = STACK_PAINT;
+	}
+	basic_stack[0] = (uint8_t)STACK_CANARY;
+	basic_stack[1] = (uint8_t)(STACK_CANARY >> 8);
+	
 	/* Create idle "task" */
 	kernel_request_create_args.f = (voidfuncvoid_ptr)idle;
 	kernel_request_create_args.level = NULL;
+	kernel_request_create_args.stack_size = MINSTACK;
 	kernel_create_task();
 	
 	/* Create "main" task as SYSTEM level. */
 	kernel_request_create_args.f = (voidfuncvoid_ptr)r_main;
 	kernel_request_create_args.level = SYSTEM;
+	kernel_request_create_args.priority = DEFAULT_PRIORITY;
+	kernel_request_create_args.stack_size = WORKSPACE;
 	kernel_create_task();
 	
 	/* First time through. Select "main" task to run first. */
 	cur_task = task_desc;
 	cur_task->state = RUNNING;
-	dequeue(&system_queue);
+	ready_dequeue(SYSTEM);
 	
 	/* Initilize time slot */
 	if(PT > 0)
 	{
-		ticks_remaining = PPP[1];
+		ticks_remaining = PPP_READ(1);
 	}
 	
 	/* Set up Timer 1 Output Compare interrupt,the TICK clock. */
@@ -1071,6 +1870,8 @@ int Task_Create(void (*f)(void), int arg, unsigned int level, unsigned int name)
 	kernel_request_create_args.arg = arg;
 	kernel_request_create_args.level = (uint8_t)level;
 	kernel_request_create_args.name = (uint8_t)name;
+	kernel_request_create_args.priority = DEFAULT_PRIORITY;
+	kernel_request_create_args.stack_size = WORKSPACE;
 	
 	kernel_request = TASK_CREATE;
 	enter_kernel();
@@ -1093,6 +1894,8 @@ int8_t   Task_Create_RR(void (*f)(void), int16_t arg){
 	kernel_request_create_args.arg = arg;
 	kernel_request_create_args.level = (uint8_t)1;
 	kernel_request_create_args.name = (uint8_t)0;
+	kernel_request_create_args.priority = DEFAULT_PRIORITY;
+	kernel_request_create_args.stack_size = WORKSPACE;
 	
 	kernel_request = TASK_CREATE;
 	enter_kernel();
@@ -1104,6 +1907,294 @@ int8_t   Task_Create_RR(void (*f)(void), int16_t arg){
 }
 
 
+/**
+ * @brief Create a SYSTEM task at a given priority inside the SYSTEM level.
+ */
+int8_t   Task_Create_System_Priority(void (*f)(void), int16_t arg, uint8_t priority){
+	int retval;
+	uint8_t sreg;
+	
+	if(priority >= PRIORITY_LEVELS)
+	{
+		return 0;
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
+	kernel_request_create_args.arg = arg;
+	kernel_request_create_args.level = SYSTEM;
+	kernel_request_create_args.name = (uint8_t)0;
+	kernel_request_create_args.priority = priority;
+	kernel_request_create_args.stack_size = WORKSPACE;
+	
+	kernel_request = TASK_CREATE;
+	enter_kernel();
+	
+	retval = kernel_request_retval;
+	SREG = sreg;
+	
+	return retval;
+}
+
+
+/**
+ * @brief Create a RR task at a given priority inside the RR level.
+ */
+int8_t   Task_Create_RR_Priority(void (*f)(void), int16_t arg, uint8_t priority){
+	int retval;
+	uint8_t sreg;
+	
+	if(priority >= PRIORITY_LEVELS)
+	{
+		return 0;
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
+	kernel_request_create_args.arg = arg;
+	kernel_request_create_args.level = RR;
+	kernel_request_create_args.name = (uint8_t)0;
+	kernel_request_create_args.priority = priority;
+	kernel_request_create_args.stack_size = WORKSPACE;
+	
+	kernel_request = TASK_CREATE;
+	enter_kernel();
+	
+	retval = kernel_request_retval;
+	SREG = sreg;
+	
+	return retval;
+}
+
+
+/**
+ * @brief Create a task of any level with a stack of stack_size bytes.
+ */
+int8_t   Task_Create_Stack(void (*f)(void), int16_t arg, uint8_t level, uint8_t name, uint16_t stack_size){
+	int retval;
+	uint8_t sreg;
+	
+	if(level != SYSTEM && level != PERIODIC && level != RR)
+	{
+		return 0;
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	kernel_request_create_args.f = (voidfuncvoid_ptr)f;
+	kernel_request_create_args.arg = arg;
+	kernel_request_create_args.level = level;
+	kernel_request_create_args.name = name;
+	kernel_request_create_args.priority = DEFAULT_PRIORITY;
+	kernel_request_create_args.stack_size = stack_size;
+	
+	kernel_request = TASK_CREATE;
+	enter_kernel();
+	
+	retval = kernel_request_retval;
+	SREG = sreg;
+	
+	return retval;
+}
+
+
+/**
+ * @brief Create a SYSTEM or PERIODIC task whose jobs run to completion on the shared basic stack.
+ */
+int8_t   Task_Create_Basic(void (*f)(void), int16_t arg, uint8_t level, uint8_t name){
+	return Task_Create_Stack(f, arg, level, name, 0);
+}
+
+
+/**
+ * @brief The RR task that calls every coroutine once per turn, dropping those that end.
+ *
+ * Coroutines started meanwhile are appended at the tail, so they run in the same
+ * pass. The task terminates once none is left.
+ */
+static void coroutine_runner(void)
+{
+	COROUTINE* prev;
+	COROUTINE* co;
+	uint8_t sreg;
+	
+	for(;;)
+	{
+		prev = NULL;
+		co = coroutine_head;
+		
+		while(co != NULL)
+		{
+			if(co->f(co) == CO_ENDED)
+			{
+				sreg = SREG;
+				Disable_Interrupt();
+				
+				if(prev == NULL)
+				{
+					coroutine_head = co->next;
+				}
+				else
+				{
+					prev->next = co->next;
+				}
+				if(coroutine_tail == co)
+				{
+					coroutine_tail = prev;
+				}
+				co = co->next;
+				
+				SREG = sreg;
+			}
+			else
+			{
+				prev = co;
+				co = co->next;
+			}
+		}
+		
+		Disable_Interrupt();
+		if(coroutine_head == NULL)
+		{
+			/* Still disabled, so no Coroutine_Start() can slip in before the task is gone. */
+			coroutine_task = 0;
+			Task_Terminate();
+		}
+		Enable_Interrupt();
+		
+		Task_Next();
+	}
+}
+
+/**
+ * @brief Start a coroutine, creating the task that runs them if there is none.
+ */
+int8_t Coroutine_Start(COROUTINE* co, coroutine_fn f, int16_t arg)
+{
+	uint8_t sreg;
+	int8_t retval = 1;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	if(!coroutine_task)
+	{
+		retval = Task_Create_Stack(coroutine_runner, 0, RR, 0, COROUTINE_STACK);
+		coroutine_task = retval != 0;
+	}
+	
+	if(retval)
+	{
+		co->line = 0;
+		co->f = f;
+		co->arg = arg;
+		co->next = NULL;
+		
+		if(coroutine_tail == NULL)
+		{
+			coroutine_head = co;
+		}
+		else
+		{
+			coroutine_tail->next = co;
+		}
+		coroutine_tail = co;
+	}
+	
+	SREG = sreg;
+	
+	return retval;
+}
+
+
+/**
+ * @brief Chain the blocks of a pool into its free list.
+ */
+void Pool_Init(POOL* p)
+{
+	uint8_t* block = p->storage;
+	uint8_t blocks;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	p->free = p->blocks > 0 ? p->storage : NULL;
+	for(blocks = p->blocks; blocks > 1; blocks--)
+	{
+		*(void**)block = block + p->size;
+		block += p->size;
+	}
+	if(p->free != NULL)
+	{
+		*(void**)block = NULL;
+	}
+	
+	p->used = 0;
+	p->high_water = 0;
+	
+	SREG = sreg;
+}
+
+
+/**
+ * @brief Take the first free block of a pool, NULL if all are in use.
+ */
+void* Pool_TryAlloc(POOL* p)
+{
+	void* block;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	block = p->free;
+	if(block != NULL)
+	{
+		p->free = *(void**)block;
+		if(++p->used > p->high_water)
+		{
+			p->high_water = p->used;
+		}
+	}
+	
+	SREG = sreg;
+	
+	return block;
+}
+
+
+/**
+ * @brief Put a block back at the head of the free list of its pool.
+ */
+void Pool_Free(POOL* p, void* block)
+{
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	*(void**)block = p->free;
+	p->free = block;
+	p->used--;
+	
+	SREG = sreg;
+}
+
+
+/**
+ * @brief The most blocks of a pool ever in use at once.
+ */
+uint8_t Pool_HighWater(POOL* p)
+{
+	return p->high_water;
+}
+
 /**
  * @brief The calling task gives up its share of the processor voluntarily.
  */
@@ -1155,6 +2246,145 @@ int Task_GetArg(void)
 	return arg;
 }
 
+/** @brief Bytes of its stack the calling task has used, from the paint left untouched.
+ */
+uint16_t Task_StackHighWater(void)
+{
+	uint16_t untouched = 2;		/* the canary */
+	uint8_t* stack = cur_task->stack;
+	uint16_t stack_size = cur_task->stack_size;
+	
+	/* Basic tasks share one stack, and all their jobs count towards it. */
+	if(cur_task->basic)
+	{
+		stack = basic_stack;
+		stack_size = BASIC_STACK;
+	}
+	
+	/* Nothing but the calling task and the interrupts it takes write its stack, so no lock is needed. */
+	while(untouched < stack_size && stack[untouched] == STACK_PAINT)
+	{
+		++untouched;
+	}
+	
+	return stack_size - untouched;
+}
+
+/**
+ * @brief Copy an account into stats. Interrupts must be disabled.
+ */
+static void get_stats(const cpu_account_t* cpu, TASK_STATS* stats)
+{
+	stats->cycles = cpu->cycles;
+	stats->window = cpu->window;
+	stats->load = cpu->window / ((uint32_t)LOAD_WINDOW * TICK_CYCLES / 1000);
+}
+
+/** @brief CPU time used by the calling task.
+ */
+void Task_GetStats(TASK_STATS* stats)
+{
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	get_stats(&cur_task->cpu, stats);
+	
+	SREG = sreg;
+}
+
+/** @brief Share of the last window not spent idle, and the idle and kernel times.
+ */
+uint16_t OS_GetLoad(TASK_STATS* idle, TASK_STATS* kernel)
+{
+	TASK_STATS idle_stats;
+	uint8_t done;
+	uint8_t sreg;
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	done = load_window_done;
+	get_stats(&idle_task->cpu, &idle_stats);
+	if(idle != NULL)
+	{
+		*idle = idle_stats;
+	}
+	if(kernel != NULL)
+	{
+		get_stats(&kernel_cpu, kernel);
+	}
+	
+	SREG = sreg;
+	
+	/* Nothing is known before the first window ends. */
+	if(!done)
+	{
+		return 0;
+	}
+	
+	return idle_stats.load >= 1000 ? 0 : 1000 - idle_stats.load;
+}
+
+#ifdef JOB_HISTOGRAMS
+/**
+ * @brief The time in timer counts since the kernel started, modulo 2^32.
+ *
+ * @param now a TCNT1 value read at most one TICK after the last tick
+ */
+static uint32_t job_clock(uint16_t now)
+{
+	return kernel_ticks * TICK_CYCLES + (uint16_t)(now - (uint16_t)(OCR1A - TICK_CYCLES));
+}
+
+/**
+ * @brief Count a job time in its log2 bucket and keep the maximum.
+ */
+static void job_record(uint16_t* histogram, uint32_t* max, uint32_t value)
+{
+	uint32_t units = value >> JOB_HIST_SHIFT;
+	uint8_t bucket = 0;
+	
+	if(value > *max)
+	{
+		*max = value;
+	}
+	
+	while(units != 0 && bucket < JOB_HIST_BUCKETS - 1)
+	{
+		units >>= 1;
+		++bucket;
+	}
+	
+	if(histogram[bucket] != 0xFFFF)
+	{
+		++histogram[bucket];
+	}
+}
+
+/** @brief Copy the job history of a PERIODIC name.
+ */
+int8_t Task_GetJobStats(uint8_t name, JOB_STATS* stats)
+{
+	uint8_t sreg;
+	
+	if(name == IDLE || name > MAXNAME)
+	{
+		return 0;
+	}
+	
+	sreg = SREG;
+	Disable_Interrupt();
+	
+	*stats = job_stats[name];
+	
+	SREG = sreg;
+	
+	return 1;
+}
+#endif
+
 /**
  * Runtime entry point into the program; just start the RTOS.  The application layer must define r_main() for its entry point.
  */
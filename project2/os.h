@@ -183,9 +183,28 @@ extern "C" {
 /** max. number of processes supported */  
 #define MAXPROCESS		8   
 
-/** workspace size of each process in bytes */ 
+/** workspace size of each process in bytes, for tasks created without a stack size */ 
 #define WORKSPACE	256
 
+/** smallest stack a task may be given: its initial context plus a few calls */
+#define MINSTACK	64
+
+/** bytes shared by all task stacks (including the idle task's MINSTACK);
+ *  define it smaller when the tasks are given smaller stacks */
+#ifndef STACK_ARENA
+#define STACK_ARENA	(MAXPROCESS * WORKSPACE + MINSTACK)
+#endif
+
+/** bytes of the one stack all basic tasks run on \sa Task_Create_Basic() */
+#ifndef BASIC_STACK
+#define BASIC_STACK	256
+#endif
+
+/** bytes of the stack of the RR task that runs all coroutines \sa Coroutine_Start() */
+#ifndef COROUTINE_STACK
+#define COROUTINE_STACK	WORKSPACE
+#endif
+
 /** time resolution */
 #define TICK			    5     // resolution of system clock in milliseconds
 #define QUANTUM       5     // a quantum for RR tasks
@@ -193,6 +212,27 @@ extern "C" {
 /** thread runtime stack */
 #define MAXSTACK      256   // bytes
 
+/** number of priority levels inside each of the SYSTEM and RR scheduling levels (at most 8);
+ *  0 is the highest priority and PRIORITY_LEVELS-1 the lowest. */
+#define PRIORITY_LEVELS   4
+
+/** priority given to SYSTEM and RR tasks that are created without one */
+#define DEFAULT_PRIORITY  (PRIORITY_LEVELS - 1)
+
+/** number of buckets in each JOB_STATS histogram; bucket i > 0 counts times in
+ *  [2^(i-1), 2^i) << JOB_HIST_SHIFT timer counts, the last bucket everything longer */
+#define JOB_HIST_BUCKETS  12
+
+/** timer counts (0.5 usec) per unit of the JOB_STATS histograms, as a shift: 4 = 8 usec */
+#ifndef JOB_HIST_SHIFT
+#define JOB_HIST_SHIFT    4
+#endif
+
+/** length in TICKs of the window Task_GetStats() and OS_GetLoad() report loads over */
+#ifndef LOAD_WINDOW
+#define LOAD_WINDOW   200
+#endif
+
 /* scheduling levels */
 
 /** a scheduling level: system tasks with first-come-first-served policy 
@@ -226,6 +266,118 @@ extern "C" {
  */
 typedef struct service SERVICE;  
 
+#ifdef JOB_HISTOGRAMS
+/** History of the jobs of one PERIODIC task; all times are in timer counts (TCNT1, F_CPU/8).
+ * A job is released when its PPP slot begins, starts when it is first dispatched,
+ * and completes when it calls Task_Next().
+ * \sa Task_GetJobStats().
+ */
+typedef struct
+{
+    /** completed jobs, stops at 65535 */
+    uint16_t jobs;
+    /** longest release to completion */
+    uint32_t max_response;
+    /** longest release to start */
+    uint32_t max_jitter;
+    /** most CPU time used by one job */
+    uint32_t max_execution;
+    /** release to completion, log2 buckets (see JOB_HIST_BUCKETS) */
+    uint16_t response[JOB_HIST_BUCKETS];
+    /** release to start */
+    uint16_t jitter[JOB_HIST_BUCKETS];
+    /** CPU time used */
+    uint16_t execution[JOB_HIST_BUCKETS];
+} JOB_STATS;
+#endif
+
+/** A coroutine: a function the kernel calls over and over, resuming it where it last yielded.
+ * It keeps no stack between calls, so its locals are lost at every CO_YIELD();
+ * anything it needs across one belongs in a struct that starts with the COROUTINE.
+ * \sa Coroutine_Start(), CO_BEGIN().
+ */
+typedef struct coroutine COROUTINE;
+
+/** The function of a coroutine: CO_BEGIN(), the body, CO_END(). */
+typedef int8_t (*coroutine_fn)(COROUTINE *co);
+
+struct coroutine
+{
+    /** where to resume: the source line of the last CO_YIELD() or CO_WAIT_UNTIL(), 0 to start over */
+    uint16_t     line;
+    /** the function */
+    coroutine_fn f;
+    /** the argument given to Coroutine_Start() */
+    int16_t      arg;
+    /** the next coroutine to run */
+    COROUTINE   *next;
+};
+
+/** Returned by a coroutine that is to be called again. */
+#define CO_WAITING  0
+/** Returned by a coroutine that is finished. */
+#define CO_ENDED    1
+
+/** Open the body of a coroutine_fn. Locals must be declared before it, and are not
+ *  kept across CO_YIELD(). A switch may not be used inside the body, and there
+ *  can be at most one CO_YIELD() or CO_WAIT_UNTIL() per source line. */
+#define CO_BEGIN(co)            switch((co)->line) { case 0:
+
+/** Give the other coroutines a turn, and carry on from here on the next call. */
+#define CO_YIELD(co)            do { (co)->line = __LINE__; return CO_WAITING; case __LINE__:; } while(0)
+
+/** Yield until cond holds; cond is checked right away and on every later call. */
+#define CO_WAIT_UNTIL(co, cond) do { (co)->line = __LINE__; case __LINE__: if(!(cond)) return CO_WAITING; } while(0)
+
+/** Finish the coroutine: the kernel drops it and it may be started again. */
+#define CO_EXIT(co)             do { (co)->line = 0; return CO_ENDED; } while(0)
+
+/** Close the body of a coroutine_fn; falling off the end finishes it. */
+#define CO_END(co)              } (co)->line = 0; return CO_ENDED
+
+/** CPU time used by a task, the idle task or the kernel.
+ * \sa Task_GetStats(), OS_GetLoad().
+ */
+typedef struct
+{
+    /** timer counts (TCNT1, F_CPU/8) run in total */
+    uint32_t cycles;
+    /** timer counts run in the last complete window of LOAD_WINDOW TICKs */
+    uint32_t window;
+    /** window as a share of the window's length, in tenths of a percent */
+    uint16_t load;
+} TASK_STATS;
+
+/** Bytes taken by each block of a pool of \a size byte blocks; a free block holds a pointer. */
+#define POOL_BLOCK_SIZE(size)   ((size) < sizeof(void*) ? sizeof(void*) : (size))
+
+/** A pool of fixed-size memory blocks, declared with POOL_DEFINE()
+ * \sa Pool_Init().
+ */
+typedef struct
+{
+    /** the blocks, the bytes each takes and how many there are; set by POOL_DEFINE() */
+    uint8_t *storage;
+    uint16_t size;
+    uint8_t  blocks;
+    /** first free block; each free block starts with a pointer to the next */
+    void    *free;
+    /** blocks in use, and the most ever in use at once */
+    uint8_t  used;
+    uint8_t  high_water;
+} POOL;
+
+/** Declare the pool \a name of \a blocks blocks of \a size bytes, with its storage.
+ *  The storage and the descriptor come from the one declaration, so their size and
+ *  count cannot disagree; a count over 255 fails to build, in C as in C++.
+ *  Use it at file scope.
+ *  \sa Pool_Init().
+ */
+#define POOL_DEFINE(name, size, blocks) \
+    typedef char name##_blocks_fit_in_uint8[(blocks) <= 255 ? 1 : -1]; \
+    static uint8_t name##_storage[POOL_BLOCK_SIZE(size) * (blocks)]; \
+    static POOL name = { name##_storage, POOL_BLOCK_SIZE(size), (blocks) }
+
 
 /*================
   *    G L O B A L S
@@ -291,6 +443,68 @@ int8_t   Task_Create_RR(    void (*f)(void), int16_t arg);
    */
 int8_t   Task_Create_Periodic(void(*f)(void), int16_t arg, uint16_t period, uint16_t wcet, uint16_t start);
 
+ /**
+   * \param f  a parameterless function to be created as a process instance
+   * \param arg an integer argument to be assigned to this process instanace
+   * \param priority its priority inside its scheduling level, 0 (highest) to PRIORITY_LEVELS-1
+   * \return 0 if not successful; otherwise non-zero.
+   * \sa Task_Create_System(), Task_Create_RR()
+   *
+   *  Same as Task_Create_System() and Task_Create_RR(), but the new task is
+   *  placed at the given priority inside its level. Tasks of equal priority
+   *  keep their FCFS (SYSTEM) or round-robin (RR) order. Task_Create_System()
+   *  and Task_Create_RR() use DEFAULT_PRIORITY.
+   *
+   * \sa \ref policy
+   */
+int8_t   Task_Create_System_Priority(void (*f)(void), int16_t arg, uint8_t priority);
+int8_t   Task_Create_RR_Priority(    void (*f)(void), int16_t arg, uint8_t priority);
+
+ /**
+   * \param f  a parameterless function to be created as a process instance
+   * \param arg an integer argument to be assigned to this process instanace
+   * \param level its scheduling level, SYSTEM, PERIODIC or RR
+   * \param name its name in the PPP[] array if PERIODIC, ignored otherwise
+   * \param stack_size the size of its stack in bytes, at least MINSTACK
+   * \return 0 if not successful; otherwise non-zero.
+   * \sa Task_Create_System(), Task_Create_RR()
+   *
+   *  Same as the other Task_Create calls, which give every task WORKSPACE
+   *  bytes, but the new task gets a stack of \a stack_size bytes. Stacks are
+   *  carved from an arena of STACK_ARENA bytes. A terminated task's stack is
+   *  reused by a later task that fits in it; 0 is returned if no free stack
+   *  fits and the arena is full. A task that fits in no free stack, when no
+   *  free descriptor is stackless or owns the last stack carved, leaks the
+   *  old stack of the descriptor it is given, so mixing stack sizes while
+   *  tasks die and are re-created can use up the arena. SYSTEM and RR tasks
+   *  get DEFAULT_PRIORITY.
+   */
+int8_t   Task_Create_Stack(void (*f)(void), int16_t arg, uint8_t level, uint8_t name, uint16_t stack_size);
+
+ /**
+   * \param f  the job: a parameterless function that runs to completion
+   * \param arg an integer argument to be assigned to this process instanace
+   * \param level its scheduling level, SYSTEM or PERIODIC
+   * \param name its name in the PPP[] array if PERIODIC, ignored otherwise
+   * \return 0 if not successful; otherwise non-zero.
+   * \sa Task_Create_Stack()
+   *
+   *  A basic task has no stack of its own. Each time it is dispatched it
+   *  calls \a f afresh on the shared stack of BASIC_STACK bytes, and the job
+   *  ends when \a f calls Task_Next(); nothing of it is kept until the next
+   *  job. A PERIODIC basic task runs one job per PPP slot, and returning from
+   *  \a f is the same as Task_Next(). A SYSTEM one runs a job each time it
+   *  reaches the head of its queue, and terminates when \a f returns.
+   *
+   *  Basic jobs must not wait for anything. They then end in the reverse of
+   *  the order they start, so a job that pre-empts another simply runs on the
+   *  shared stack below it; resuming one out of that order is
+   *  ERR_RUN_7_BASIC_JOB_OUT_OF_ORDER. A PERIODIC basic job still unfinished
+   *  when its slot ends is ERR_RUN_3_PERIODIC_TOOK_TOO_LONG.
+   *  Task_Create_Stack() with a \a stack_size of 0 is the same call.
+   */
+int8_t   Task_Create_Basic(void (*f)(void), int16_t arg, uint8_t level, uint8_t name);
+
 /** 
  * Terminate the calling process
  *
@@ -307,6 +521,114 @@ void Task_Next();
   */
 int16_t Task_GetArg();          
 
+/** 
+  * \return the most bytes of its stack the calling task has used so far.
+  *
+  *  Every stack is painted when its task is created, so this counts the bytes
+  *  that are no longer paint, from the top of the stack down to the deepest
+  *  byte written. Compare it with WORKSPACE (or the size given to
+  *  Task_Create_Stack()) to size stacks from real use. For a basic task it
+  *  is the deepest use of the shared stack by all basic jobs, to compare
+  *  with BASIC_STACK. Unless NO_STACK_CHECK
+  *  is defined, a task that reaches the canary at the end of its stack is
+  *  caught with OS_Abort() the next time it leaves the processor.
+  */
+uint16_t Task_StackHighWater();
+
+/** 
+  * \param stats filled with the CPU time used by the calling task
+  *
+  *  The kernel reads TCNT1 each time it gives the processor to a task and each
+  *  time it gets it back, and charges the difference to the task. Time spent
+  *  in the kernel, including the timer interrupt's context switch, is charged
+  *  to the kernel instead. Every LOAD_WINDOW TICKs the counts of the window
+  *  just ended become the "window" reported here.
+  */
+void Task_GetStats(TASK_STATS *stats);
+
+/** 
+  * \param idle if not NULL, filled with the CPU time used by the idle task
+  * \param kernel if not NULL, filled with the CPU time used by the kernel
+  * \return the share of the last complete window not spent idle, in tenths of a percent.
+  *
+  *  The load includes kernel time. 1000 minus the load is the headroom left.
+  *  It is 0 until the first window completes.
+  */
+uint16_t OS_GetLoad(TASK_STATS *idle, TASK_STATS *kernel);
+
+#ifdef JOB_HISTOGRAMS
+/** 
+  * \param name a PERIODIC name from the PPP[] array
+  * \param stats filled with the history of that name's jobs
+  * \return 0 if \a name is out of range [1 .. MAXNAME]; otherwise non-zero.
+  *
+  *  Only available when the kernel is built with -DJOB_HISTOGRAMS. The history is
+  *  kept per name, so it carries over when a terminated task's name is reused.
+  *  Compare max_execution with the slot length and the histograms with the
+  *  period to tune the PPP[] array from real runs.
+  */
+int8_t Task_GetJobStats(uint8_t name, JOB_STATS *stats);
+#endif
+
+
+  /*=====  Coroutines API ===== */
+
+/**
+  * \param co the coroutine's state, which must stay valid until it ends
+  * \param f  its function
+  * \param arg an integer argument, read back as co->arg
+  * \return 0 if the coroutine task could not be created; otherwise non-zero.
+  *
+  *  All coroutines are run by one RR task with a stack of COROUTINE_STACK
+  *  bytes, which calls each of them in turn, in the order they were started,
+  *  and then gives up the processor with Task_Next(). A coroutine therefore
+  *  costs the few bytes of its COROUTINE, not a stack, and dozens of I/O state
+  *  machines can wait side by side with CO_WAIT_UNTIL(). The task is created by
+  *  the first Coroutine_Start() and terminates when the last coroutine ends.
+  *
+  *  A coroutine must not call anything that blocks (Service_Subscribe(),
+  *  Task_Next(), a busy loop), as that stops every coroutine. Tasks and other
+  *  coroutines may start coroutines; ISRs may not.
+  */
+int8_t Coroutine_Start(COROUTINE *co, coroutine_fn f, int16_t arg);
+
+
+  /*=====  Memory Pool API ===== */
+
+/**
+  * \param p a pool declared with POOL_DEFINE()
+  *
+  *  Chains the blocks of \a p into its free list; call it once, before anything
+  *  uses \a p. Each pool hands out blocks of one size, so it never fragments;
+  *  use one pool per size (packets, trace buffers, ...). Free blocks are chained
+  *  through their own first bytes, so allocating and freeing are constant time.
+  */
+void Pool_Init(POOL *p);
+
+/**
+  * \param p a pool
+  * \return a block of \a p, or NULL if all are in use
+  *
+  *  Never waits. Safe to call from ISRs.
+  */
+void *Pool_TryAlloc(POOL *p);
+
+/**
+  * \param p the pool the block came from
+  * \param block a block from Pool_TryAlloc()
+  *
+  *  Puts the block back in \a p. Constant time; safe to call from ISRs.
+  */
+void Pool_Free(POOL *p, void *block);
+
+/**
+  * \param p a pool
+  * \return the most blocks of \a p that were ever in use at once
+  *
+  *  Compare it with the number of blocks to size pools from real use.
+  */
+uint8_t Pool_HighWater(POOL *p);
+
 
   /*=====  Events API ===== */
 
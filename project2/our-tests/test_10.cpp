@@ -0,0 +1,54 @@
+/**
+TESTING Task_Sleep and Task_Delay_Until
+test should create 2 rr tasks and a busy rr task, pin 7 toggles every 20ms (4 ticks) and pin 6
+every 50ms (10 ticks) with no drift, while the busy task keeps pin 5 toggling in between
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+
+#define OUTPUT_PIN_1 7 //digital pin 7;
+#define OUTPUT_PIN_2 6 //digital pin 6;
+#define OUTPUT_PIN_3 5 //digital pin 5;
+
+void sleeper(void)
+{
+    //toggle pin every 4 ticks, drifting by its own run time
+    for(;;)
+    {
+        PORTB ^= _BV(OUTPUT_PIN_1);
+        Task_Sleep(4);
+    }
+}
+
+void delayer(void)
+{
+    uint16_t last_wake = Now_Ticks();
+
+    //toggle pin exactly every 10 ticks
+    for(;;)
+    {
+        PORTB ^= _BV(OUTPUT_PIN_2);
+        Task_Delay_Until(&last_wake, 10);
+    }
+}
+
+void busy(void)
+{
+    //gets all the time the sleepers do not use
+    for(;;)
+    {
+        PORTB ^= _BV(OUTPUT_PIN_3);
+    }
+}
+
+int r_main(void)
+{
+    DDRB = _BV(OUTPUT_PIN_1) | _BV(OUTPUT_PIN_2) | _BV(OUTPUT_PIN_3);
+    PORTB = 0;
+    Task_Create_RR(sleeper, 0);
+    Task_Create_RR(delayer, 0);
+    Task_Create_RR(busy, 0);
+    return 0;
+}
@@ -0,0 +1,77 @@
+/**
+TESTING Service_Publish fan-out
+build with -DSUBSCRIBERS=1, 4 and 7 (default 7). test creates that many SYSTEM tasks subscribed
+to one service and an rr task publishing to it. for every publish the trace gets the TCNT3 cycles
+from the call to Service_Publish until the last subscriber has the value, 20 publishes in all.
+the rr task should see one kernel round trip however many subscribers there are,
+each extra subscriber only adding its own dispatch
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#ifndef SUBSCRIBERS
+#define SUBSCRIBERS 7
+#endif
+
+#define PUBLISHES 20
+
+SERVICE* broadcast;
+uint16_t publish_time;
+uint8_t received;
+
+void subscriber(void)
+{
+    int16_t v;
+
+    for(;;)
+    {
+        Service_Subscribe(broadcast, &v);
+
+        //the last subscriber to run closes the measurement
+        if(++received == SUBSCRIBERS)
+        {
+            add_to_trace(TCNT3 - publish_time);
+        }
+    }
+}
+
+void publisher(void)
+{
+    int16_t i;
+
+    for(i = 0; i < PUBLISHES; i++)
+    {
+        received = 0;
+        publish_time = TCNT3;
+        Service_Publish(broadcast, i);
+        Task_Next();
+    }
+    print_trace();
+}
+
+int r_main(void)
+{
+    uint8_t i;
+
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(12);
+
+    /* Run clock at F_CPU. */
+    TCCR3B = _BV(CS30);
+
+    broadcast = Service_Init();
+    Task_Create_RR(publisher, 0);
+
+    //r_main is the last subscriber, so 7 of them fit in MAXPROCESS with the publisher
+    for(i = 1; i < SUBSCRIBERS; i++)
+    {
+        Task_Create_System(subscriber, i);
+    }
+    subscriber();
+    return 0;
+}
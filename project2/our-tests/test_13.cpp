@@ -0,0 +1,60 @@
+/**
+TESTING Service_Init_Queued
+test should create a periodic task publishing 0, 1, 2, ... every 4 ticks to a queued service of
+depth 8, and an rr consumer that sleeps 12 ticks after every 4th value it gets. the trace should
+hold 0 to 19 in order with none missing, although the consumer falls 3 values behind at times
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#define VALUES 20
+
+SERVICE* samples;
+
+void producer(void)
+{
+    int16_t i = 0;
+
+    for(;;)
+    {
+        Service_Publish(samples, i++);
+        Task_Next();
+    }
+}
+
+void consumer(void)
+{
+    int16_t v;
+    uint8_t i;
+
+    //the first call marks where the consumer starts reading
+    Service_Subscribe(samples, &v);
+    add_to_trace(v);
+
+    for(i = 1; i < VALUES; i++)
+    {
+        if(i % 4 == 0)
+        {
+            Task_Sleep(12);
+        }
+        Service_Subscribe(samples, &v);
+        add_to_trace(v);
+    }
+    print_trace();
+}
+
+int r_main(void)
+{
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(13);
+
+    samples = Service_Init_Queued(8);
+    Task_Create_RR(consumer, 0);
+    Task_Create_Periodic(producer, 0, 4, 1, 2);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/**
+TESTING Service_Init_Payload
+test should create 3 system subscribers and an rr publisher sending a 26 byte struct 50 times
+through a payload service. each subscriber toggles its pin (0 to 2) when the struct it got is intact,
+and releases it. afterwards all PAYLOAD_BLOCKS must be free again, and pin 7 goes high
+ */
+
+#include <avr/io.h>
+#include <string.h>
+#include "common.h"
+#include "os.h"
+
+#define ROUNDS 50
+#define DONE_PIN 7 //digital pin 13;
+
+typedef struct
+{
+    uint8_t seq;
+    uint8_t data[24];
+    uint8_t check;
+} sample_t;
+
+SERVICE* samples;
+
+void subscriber(void)
+{
+    sample_t* s;
+    uint8_t i;
+    uint8_t sum;
+
+    for(;;)
+    {
+        s = (sample_t*)Service_Subscribe_Payload(samples);
+
+        sum = s->seq;
+        for(i = 0; i < sizeof(s->data); i++)
+        {
+            sum += s->data[i];
+        }
+        if(sum == s->check)
+        {
+            PORTB ^= _BV(Task_GetArg());
+        }
+        Payload_Release(s);
+    }
+}
+
+void publisher(void)
+{
+    sample_t* s;
+    void* blocks[PAYLOAD_BLOCKS];
+    uint8_t n;
+    uint8_t i;
+
+    for(n = 0; n < ROUNDS; n++)
+    {
+        s = (sample_t*)Payload_Alloc();
+        s->seq = n;
+        memset(s->data, n, sizeof(s->data));
+        s->check = n + n * sizeof(s->data);
+        Service_Publish_Payload(samples, s);
+
+        //let the subscribers release it and wait again
+        Task_Next();
+    }
+
+    //every block is back in the pool
+    for(i = 0; i < PAYLOAD_BLOCKS; i++)
+    {
+        blocks[i] = Payload_Alloc();
+        if(blocks[i] == NULL)
+        {
+            return;
+        }
+    }
+    PORTB |= _BV(DONE_PIN);
+}
+
+int r_main(void)
+{
+    uint8_t i;
+
+    DDRB = 0xFF;
+    PORTB = 0;
+
+    samples = Service_Init_Payload();
+    for(i = 0; i < 3; i++)
+    {
+        Task_Create_System(subscriber, i);
+    }
+    Task_Create_RR(publisher, 0);
+    return 0;
+}
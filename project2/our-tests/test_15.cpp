@@ -0,0 +1,73 @@
+/**
+TESTING publish from an ISR
+like tests/test016_latency_interrupt: timer 3 interrupts every 4096 counts and publishes to a
+service a system task waits on. the trace gets the timer 3 counts from inside the interrupt until
+the task runs, 20 times. the request is carried out by the soft interrupt right after the ISR returns,
+so the latency should be the same every time, not up to a tick
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "common.h"
+#include "os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#define SAMPLES 20
+
+uint16_t volatile inside_interrupt = 0;
+
+SERVICE* volatile irq;
+
+void waiter(void)
+{
+    int16_t v;
+    uint8_t i;
+
+    for(i = 0; i < SAMPLES; i++)
+    {
+        Service_Subscribe(irq, &v);
+        add_to_trace(TCNT3 - inside_interrupt);
+    }
+    TIMSK3 &= ~_BV(OCIE3A);
+    print_trace();
+}
+
+void busy(void)
+{
+    //keeps an rr task running for the interrupt to land in
+    for(;;)
+    {
+    }
+}
+
+int r_main(void)
+{
+    /* setup the test */
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(15);
+
+    irq = Service_Init();
+
+    Task_Create_System(waiter, 0);
+    Task_Create_RR(busy, 0);
+
+    /* Run clock at 2MHz, CTC every 4096 counts. */
+    TCCR3A = 0;
+    TCCR3B = _BV(WGM32) | _BV(CS31);
+    OCR3A = 4095;
+
+    /* Clear flag. */
+    TIFR3 = _BV(OCF3A);
+
+    /* Set up Timer 3 Output Compare interrupt */
+    TIMSK3 |= _BV(OCIE3A);
+    return 0;
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+    inside_interrupt = TCNT3;
+    Service_Publish(irq, inside_interrupt);
+}
@@ -0,0 +1,61 @@
+/**
+TESTING Task_Notify and Task_NotifyWait
+test should create a system task waiting on bits 0 and 1 of its notification word with a 10 tick
+timeout, and an rr task setting bit 0, then bit 1, then sleeping 20 ticks. the waiter toggles
+pin 6 for bit 0 and pin 5 for bit 1, and pin 7 on each timeout, so pins 6 and 5 toggle together
+every 20 ticks and pin 7 once in between
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+
+#define BIT0_PIN 6
+#define BIT1_PIN 5
+#define TIMEOUT_PIN 7
+
+TASK* volatile waiter_task;
+
+void waiter(void)
+{
+    uint16_t bits;
+
+    waiter_task = Task_Self();
+    for(;;)
+    {
+        bits = Task_NotifyWait(0x0003, 10);
+        if(bits == 0)
+        {
+            PORTB ^= _BV(TIMEOUT_PIN);
+        }
+        if(bits & 0x0001)
+        {
+            PORTB ^= _BV(BIT0_PIN);
+        }
+        if(bits & 0x0002)
+        {
+            PORTB ^= _BV(BIT1_PIN);
+        }
+    }
+}
+
+void notifier(void)
+{
+    for(;;)
+    {
+        Task_Notify(waiter_task, 0x0001, NOTIFY_SET_BITS);
+        Task_Notify(waiter_task, 0x0002, NOTIFY_SET_BITS);
+        Task_Sleep(20);
+    }
+}
+
+int r_main(void)
+{
+    DDRB = 0xFF;
+    PORTB = 0;
+
+    //the system task runs first and publishes its handle
+    Task_Create_System(waiter, 0);
+    Task_Create_RR(notifier, 0);
+    return 0;
+}
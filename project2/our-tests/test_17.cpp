@@ -0,0 +1,60 @@
+/**
+TESTING Semaphore and Event_Group
+test should create 3 rr workers sharing a semaphore with a count of 2, each holding it for
+2 ticks and setting its own bit in an event group when done. a system task waits for all 3 bits
+with EVENT_CLEAR and toggles pin 7 every round. pins 0 to 2 show which workers hold the
+semaphore; never more than 2 are high at once
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+
+#define ROUND_PIN 7 //digital pin 13;
+
+SEMAPHORE* slots;
+EVENT_GROUP* done;
+
+void worker(void)
+{
+    uint8_t me = Task_GetArg();
+
+    for(;;)
+    {
+        Semaphore_Take(slots);
+        PORTB |= _BV(me);
+        Task_Sleep(2);
+        PORTB &= ~_BV(me);
+        Semaphore_Give(slots);
+
+        Event_Group_Set(done, _BV(me));
+        Task_Sleep(1);
+    }
+}
+
+void collector(void)
+{
+    for(;;)
+    {
+        Event_Group_Wait(done, 0x0007, EVENT_WAIT_ALL | EVENT_CLEAR);
+        PORTB ^= _BV(ROUND_PIN);
+    }
+}
+
+int r_main(void)
+{
+    uint8_t i;
+
+    DDRB = 0xFF;
+    PORTB = 0;
+
+    slots = Semaphore_Init(2);
+    done = Event_Group_Init();
+
+    Task_Create_System(collector, 0);
+    for(i = 0; i < 3; i++)
+    {
+        Task_Create_RR(worker, i);
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/**
+TESTING Service_Subscribe_Timeout
+test should create a system subscriber waiting 10 ticks at a time and an rr publisher
+publishing every 25 ticks. pin 7 toggles on every timeout and pin 6 on every value received,
+so pin 7 toggles twice for every toggle of pin 6. pin 5 goes high if a value is wrong
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+
+#define TIMEOUT_PIN 7
+#define RECEIVED_PIN 6
+#define ERROR_PIN 5
+
+SERVICE* link;
+
+void subscriber(void)
+{
+    int16_t v = -1;
+    int16_t expected = 0;
+
+    for(;;)
+    {
+        if(Service_Subscribe_Timeout(link, &v, 10) == SERVICE_TIMEOUT)
+        {
+            PORTB ^= _BV(TIMEOUT_PIN);
+        }
+        else
+        {
+            if(v != expected++)
+            {
+                PORTB |= _BV(ERROR_PIN);
+            }
+            PORTB ^= _BV(RECEIVED_PIN);
+        }
+    }
+}
+
+void publisher(void)
+{
+    int16_t i = 0;
+
+    for(;;)
+    {
+        Task_Sleep(25);
+        Service_Publish(link, i++);
+    }
+}
+
+int r_main(void)
+{
+    DDRB = 0xFF;
+    PORTB = 0;
+
+    link = Service_Init();
+    Task_Create_System(subscriber, 0);
+    Task_Create_RR(publisher, 0);
+    return 0;
+}
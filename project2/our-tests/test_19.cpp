@@ -0,0 +1,104 @@
+/**
+TESTING Pool_Alloc, Pool_TryAlloc and Pool_Free
+test should create a pool of 4 packets, a system task allocating 20 of them and an rr task
+freeing one every 2 ticks. the system task waits in Pool_Alloc once the pool is empty, and
+each packet it gets is checked to be unused; pin 6 toggles for each. a timer 3 interrupt tries
+Pool_TryAlloc, which must only succeed while a block is free, and frees what it gets at once.
+at the end pin 7 goes high if the high water mark is exactly 4, pin 5 if anything was wrong
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "common.h"
+#include "os.h"
+
+#define BLOCKS 4
+#define PACKETS 20
+
+#define GOT_PIN 6
+#define DONE_PIN 7
+#define ERROR_PIN 5
+
+//a free block's first bytes hold the free list link, so the flag goes last
+typedef struct
+{
+    uint8_t data[9];
+    uint8_t in_use;
+} packet_t;
+
+POOL_DEFINE(packet_pool, sizeof(packet_t), BLOCKS);
+POOL* const packets = &packet_pool;
+
+packet_t* volatile held[PACKETS];
+uint8_t volatile allocated = 0;
+
+void allocator(void)
+{
+    packet_t* p;
+
+    while(allocated < PACKETS)
+    {
+        p = (packet_t*)Pool_Alloc(packets);
+        if(p->in_use)
+        {
+            PORTB |= _BV(ERROR_PIN);
+        }
+        p->in_use = 1;
+        held[allocated++] = p;
+        PORTB ^= _BV(GOT_PIN);
+    }
+}
+
+void freer(void)
+{
+    uint8_t freed = 0;
+
+    while(freed < PACKETS)
+    {
+        Task_Sleep(2);
+        if(freed < allocated)
+        {
+            held[freed]->in_use = 0;
+            Pool_Free(packets, held[freed++]);
+        }
+    }
+
+    TIMSK3 &= ~_BV(OCIE3A);
+    if(Pool_HighWater(packets) == BLOCKS)
+    {
+        PORTB |= _BV(DONE_PIN);
+    }
+}
+
+int r_main(void)
+{
+    DDRB = 0xFF;
+    PORTB = 0;
+
+    Pool_Init(packets);
+
+    Task_Create_System(allocator, 0);
+    Task_Create_RR(freer, 0);
+
+    /* Run clock at 2MHz, CTC every 4096 counts. */
+    TCCR3A = 0;
+    TCCR3B = _BV(WGM32) | _BV(CS31);
+    OCR3A = 4095;
+    TIFR3 = _BV(OCF3A);
+    TIMSK3 |= _BV(OCIE3A);
+    return 0;
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+    packet_t* p = (packet_t*)Pool_TryAlloc(packets);
+
+    if(p != NULL)
+    {
+        if(p->in_use)
+        {
+            PORTB |= _BV(ERROR_PIN);
+        }
+        Pool_Free(packets, p);
+    }
+}
@@ -0,0 +1,227 @@
+/**
+ * @file   ppp_schedule.h
+ *
+ * @brief Compile-time construction and validation of the PPP[] schedule.
+ *
+ * Instead of writing PPP[] and PT by hand, the application lists its PERIODIC
+ * tasks as (name, period, wcet, offset) in TICKs and lets the compiler expand
+ * them over the hyperperiod (the least common multiple of the periods):
+ *
+ *   enum { A = 1, B, C };
+ *   typedef ppp::schedule<
+ *       ppp::task<A, 20, 2>,       // every 20 TICKs, first at 0
+ *       ppp::task<B, 40, 3, 5>,    // every 40 TICKs, first at 5
+ *       ppp::task<C, 40, 1, 10>
+ *   > my_schedule;
+ *   PPP_SCHEDULE(my_schedule);
+ *
+ * This defines PT and a PPP[] holding one {name, TICKs} pair per slot, IDLE in
+ * the gaps, stored in flash. The build fails with a static_assert if a name is
+ * not in [1 .. MAXNAME] or used twice, if a WCET is 0 or not less than its
+ * period, if a job would run past the end of its period, or if two tasks are
+ * ever scheduled in the same TICK.
+ *
+ * Offsets are phases inside the hyperperiod: the table repeats, so a task with
+ * offset 5 runs at 5, 5 + period, ... in every hyperperiod. Each job must fit
+ * in one slot, so offset % period + wcet may not exceed the period; a job
+ * that wrapped would be split across the end of the table into two slots,
+ * and the kernel would abort it at the end of the first.
+ *
+ * The kernel reads PPP[] with pgm_read_byte(), so the whole application must be
+ * built with -DPPP_IN_PROGMEM when this header is used (and a hand-written PPP[]
+ * must then be declared PROGMEM too). C++11 is required (-std=gnu++11); long
+ * hyperperiods may need a larger -fconstexpr-depth.
+ */
+#ifndef __PPP_SCHEDULE_H__
+#define __PPP_SCHEDULE_H__
+
+#include <avr/pgmspace.h>
+#include "os.h"
+#include "kernel.h"
+
+#ifndef PPP_IN_PROGMEM
+#error "ppp_schedule.h puts PPP[] in flash, build everything with -DPPP_IN_PROGMEM"
+#endif
+
+/** The longest slot one PPP entry can describe, in TICKs. Longer IDLE gaps are split. */
+#define PPP_MAX_SLOT    255
+
+namespace ppp {
+
+constexpr uint32_t gcd(uint32_t a, uint32_t b) { return b == 0 ? a : gcd(b, a % b); }
+constexpr uint32_t lcm(uint32_t a, uint32_t b) { return a / gcd(a, b) * b; }
+constexpr uint32_t min(uint32_t a, uint32_t b) { return a < b ? a : b; }
+constexpr uint8_t  max(uint8_t a, uint8_t b)   { return a > b ? a : b; }
+
+
+/**
+ * @brief One PERIODIC task: runs for Wcet TICKs every Period TICKs, starting at Offset.
+ */
+template<uint8_t Name, uint16_t Period, uint8_t Wcet, uint16_t Offset = 0>
+struct task
+{
+    static_assert(Name != IDLE && Name <= MAXNAME, "PPP task name must be in [1 .. MAXNAME]");
+    static_assert(Wcet > 0, "PPP task WCET must be at least one TICK");
+    static_assert(Wcet < Period, "PPP task WCET must be less than its period");
+    static_assert(Offset % Period + Wcet <= Period, "PPP task job must end within its period, not wrap around the table");
+
+    static constexpr uint8_t  name   = Name;
+    static constexpr uint16_t period = Period;
+
+    /** True if the task owns TICK t of the hyperperiod. */
+    static constexpr bool busy(uint32_t t)
+    {
+        return (t + Period - Offset % Period) % Period < Wcet;
+    }
+};
+
+
+/**
+ * @brief Per-TICK queries over a list of tasks.
+ */
+template<typename... Tasks> struct task_set;
+
+template<> struct task_set<>
+{
+    static constexpr uint32_t hyperperiod()       { return 1; }
+    static constexpr uint8_t  owner(uint32_t)     { return IDLE; }
+    static constexpr uint8_t  load(uint32_t)      { return 0; }
+    static constexpr bool     has_name(uint8_t)   { return false; }
+    static constexpr bool     unique_names()      { return true; }
+};
+
+template<typename T, typename... Rest> struct task_set<T, Rest...>
+{
+    typedef task_set<Rest...> rest;
+
+    static constexpr uint32_t hyperperiod()       { return lcm(T::period, rest::hyperperiod()); }
+    static constexpr uint8_t  owner(uint32_t t)   { return T::busy(t) ? T::name : rest::owner(t); }
+    static constexpr uint8_t  load(uint32_t t)    { return (T::busy(t) ? 1 : 0) + rest::load(t); }
+    static constexpr bool     has_name(uint8_t n) { return T::name == n || rest::has_name(n); }
+    static constexpr bool     unique_names()      { return !rest::has_name(T::name) && rest::unique_names(); }
+};
+
+
+/**
+ * @brief The hyperperiod cut into PPP slots.
+ *
+ * A slot starts wherever the owner of a TICK changes, and every PPP_MAX_SLOT
+ * TICKs inside an IDLE gap. The ranges are halved recursively so the
+ * constexpr call depth stays logarithmic in the hyperperiod.
+ */
+template<typename Set>
+struct timeline
+{
+    static constexpr uint32_t H = Set::hyperperiod();
+
+    /** Most tasks ready in one TICK of [lo, hi). */
+    static constexpr uint8_t max_load(uint32_t lo, uint32_t hi)
+    {
+        return hi - lo == 1 ? Set::load(lo)
+            : max(max_load(lo, lo + (hi - lo) / 2), max_load(lo + (hi - lo) / 2, hi));
+    }
+
+    static constexpr bool slot_starts(uint32_t t)
+    {
+        return t == 0 || Set::owner(t) != Set::owner(t - 1)
+            || (Set::owner(t) == IDLE && t % PPP_MAX_SLOT == 0);
+    }
+
+    /** Number of slots starting in [lo, hi). */
+    static constexpr uint32_t slots(uint32_t lo, uint32_t hi)
+    {
+        return hi - lo == 1 ? (slot_starts(lo) ? 1 : 0)
+            : slots(lo, lo + (hi - lo) / 2) + slots(lo + (hi - lo) / 2, hi);
+    }
+
+    /** First slot start in [lo, hi), or hi if there is none. */
+    static constexpr uint32_t first_start(uint32_t lo, uint32_t hi)
+    {
+        return lo >= hi ? hi
+            : hi - lo == 1 ? (slot_starts(lo) ? lo : hi)
+            : first_start_or(first_start(lo, lo + (hi - lo) / 2), lo + (hi - lo) / 2, hi);
+    }
+
+    /** found if the left half [.., mid) had a slot start, else search [mid, hi). */
+    static constexpr uint32_t first_start_or(uint32_t found, uint32_t mid, uint32_t hi)
+    {
+        return found != mid ? found : first_start(mid, hi);
+    }
+
+    /** Start of the slot after the one starting at s; H after the last slot. */
+    static constexpr uint32_t next_start(uint32_t s)
+    {
+        return first_start(s + 1, min(s + PPP_MAX_SLOT + 1, H));
+    }
+
+    static constexpr uint32_t start_of(uint32_t k)
+    {
+        return k == 0 ? 0 : next_start(start_of(k - 1));
+    }
+
+    /** Entry i of PPP[]: the slot's name for even i, its length in TICKs for odd i. */
+    static constexpr uint8_t entry(uint32_t i)
+    {
+        return i % 2 == 0 ? Set::owner(start_of(i / 2))
+            : (uint8_t)(next_start(start_of(i / 2)) - start_of(i / 2));
+    }
+};
+
+
+/**
+ * @brief A validated PERIODIC schedule. Use it with PPP_SCHEDULE().
+ */
+template<typename... Tasks>
+struct schedule : timeline< task_set<Tasks...> >
+{
+    typedef timeline< task_set<Tasks...> > base;
+
+    static_assert(sizeof...(Tasks) > 0, "PPP schedule needs at least one task");
+    static_assert(task_set<Tasks...>::unique_names(), "PPP task name used twice");
+    static_assert(base::max_load(0, base::H) <= 1, "PERIODIC tasks overlap in the PPP schedule");
+
+    /** Number of {name, TICKs} pairs in PPP[]. */
+    static constexpr unsigned int PT = base::slots(0, base::H);
+};
+
+
+/** PPP[] as an object the compiler can build; laid out exactly like the array. */
+template<unsigned int N>
+struct table
+{
+    unsigned char slot[N];
+};
+
+template<unsigned int... I> struct indices {};
+
+template<unsigned int N, unsigned int... I>
+struct make_indices : make_indices<N - 1, N - 1, I...> {};
+
+template<unsigned int... I>
+struct make_indices<0, I...>
+{
+    typedef indices<I...> type;
+};
+
+template<typename S, unsigned int... I>
+constexpr table<sizeof...(I)> make_table(indices<I...>)
+{
+    return table<sizeof...(I)>{{ S::entry(I)... }};
+}
+
+} /* namespace ppp */
+
+
+/**
+ * @brief Define PT and PPP[] (in flash) from a ppp::schedule.
+ *
+ * The table object is given the assembler name "PPP" so the kernel's
+ * "extern const unsigned char PPP[]" resolves to it.
+ */
+#define PPP_SCHEDULE(S) \
+    extern const unsigned int PT = S::PT; \
+    extern const ppp::table<2 * S::PT> ppp_table __asm__("PPP") PROGMEM; \
+    const ppp::table<2 * S::PT> ppp_table PROGMEM = \
+        ppp::make_table<S>(ppp::make_indices<2 * S::PT>::type())
+
+#endif
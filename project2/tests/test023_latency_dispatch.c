@@ -0,0 +1,86 @@
+/**
+ * @file   test023.c
+ * @date   Tue Mar 17 2015
+ *
+ * @brief  Test 023 - cycle cost of a Task_Next() switch with many ready tasks
+ *
+ * Two RR tasks at priority 0 ping-pong with Task_Next() while FILLERS other
+ * RR tasks sit ready at lower priorities. Every switch records the number of
+ * TCNT3 cycles (8 MHz) since the previous task gave up the processor.
+ *
+ * Build once as is (bitmap dispatcher) and once with -DLEGACY_DISPATCH
+ * (the original if/else chain, every task in one FIFO per level), and with
+ * FILLERS from 0 to MAXPROCESS - 3. With the bitmap dispatcher the numbers
+ * do not change with FILLERS.
+ */
+
+#include "common.h"
+#include "OS/os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#ifndef FILLERS
+#define FILLERS     5
+#endif
+
+#define SAMPLES     32
+
+const unsigned int PT = 0;
+const unsigned char PPP[] = {};
+
+uint16_t volatile last = 0;
+uint8_t volatile samples = 0;
+
+void measure(void)
+{
+    uint16_t time;
+
+    for(;;)
+    {
+        time = TCNT3;
+
+        if(samples < SAMPLES)
+        {
+            add_to_trace(time - last);
+            if(++samples == SAMPLES)
+            {
+                print_trace();
+            }
+        }
+
+        last = TCNT3;
+        Task_Next();
+    }
+}
+
+void filler(void)
+{
+    for(;;)
+    {
+        last = TCNT3;
+        Task_Next();
+    }
+}
+
+int r_main(void)
+{
+    uint8_t i;
+
+    /* setup the test */
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(23);
+
+    /* Run clock at 8MHz. */
+    TCCR3B = _BV(CS30);
+
+    for(i = 0; i < FILLERS; ++i)
+    {
+        Task_Create_RR_Priority(filler, i, 1 + (i % (PRIORITY_LEVELS - 1)));
+    }
+
+    Task_Create_RR_Priority(measure, 0, 0);
+    Task_Create_RR_Priority(measure, 1, 0);
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file   test024.cpp
+ * @date   Wed Mar 18 2015
+ *
+ * @brief  Test 024 - PPP[] built and checked at compile time by ppp_schedule.h
+ *
+ * Build with -DPPP_IN_PROGMEM. A toggles pin 7 every 20 TICKs at 0, B toggles
+ * pin 6 every 40 TICKs at 5, and C toggles pin 5 every 40 TICKs at 35, ending
+ * exactly at the end of the table. Changing B's offset to 1 must fail the build
+ * (overlap with A), as must a name above MAXNAME, and so must changing C's
+ * offset to 36 (its job would wrap past the end of its period).
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+#include "ppp_schedule.h"
+
+/* Defined in os.cpp, not part of os.h. */
+int Task_Create(void (*f)(void), int arg, unsigned int level, unsigned int name);
+
+enum { A=1, B, C, D, E, F, G };
+
+typedef ppp::schedule<
+    ppp::task<A, 20, 2>,
+    ppp::task<B, 40, 3, 5>,
+    ppp::task<C, 40, 5, 35>
+> schedule;
+
+PPP_SCHEDULE(schedule);
+
+/* {A, 2, IDLE, 3, B, 3, IDLE, 12, A, 2, IDLE, 13, C, 5} */
+static_assert(schedule::PT == 7, "unexpected PPP length");
+
+void periodic_task(void)
+{
+    for(;;)
+    {
+        PORTB ^= _BV(Task_GetArg());
+        Task_Next();
+    }
+}
+
+int r_main(void)
+{
+    DDRB = _BV(PB7) | _BV(PB6) | _BV(PB5);
+    PORTB = 0;
+
+    Task_Create(periodic_task, PB7, PERIODIC, A);
+    Task_Create(periodic_task, PB6, PERIODIC, B);
+    Task_Create(periodic_task, PB5, PERIODIC, C);
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file   test025.cpp
+ * @date   Sun Oct 18 2026
+ *
+ * @brief  Test 025 - basic tasks running their jobs on the shared stack
+ *
+ * A and B are PERIODIC basic tasks toggling pins 0 and 1 once per slot. An RR
+ * task keeps creating a SYSTEM basic task toggling pin 2, which pre-empts
+ * whatever runs and starts its job below it on the shared stack. None of them
+ * keeps a stack of its own. After 100 SYSTEM jobs the deepest use of the
+ * basic stack is traced; it should stay well under BASIC_STACK.
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#define JOBS 100
+
+enum { A=1, B, C, D, E, F, G };
+const unsigned char PPP[] = {A, 2, B, 2, IDLE, 2};
+const unsigned int PT = sizeof(PPP)/2;
+
+uint16_t volatile high_water = 0;
+uint8_t volatile system_jobs = 0;
+
+void job(void)
+{
+    PORTB ^= _BV(Task_GetArg());
+    if(Task_StackHighWater() > high_water)
+    {
+        high_water = Task_StackHighWater();
+    }
+    if(Task_GetArg() == PB2)
+    {
+        ++system_jobs;
+    }
+    /* Returning ends the job: A and B run again next slot, the SYSTEM task terminates. */
+}
+
+void spawner(void)
+{
+    while(system_jobs < JOBS)
+    {
+        Task_Create_Basic(job, PB2, SYSTEM, 0);
+        Task_Next();
+    }
+    add_to_trace(high_water);
+    print_trace();
+}
+
+int r_main(void)
+{
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(25);
+
+    DDRB = _BV(PB2) | _BV(PB1) | _BV(PB0);
+    PORTB = 0;
+
+    Task_Create_Basic(job, PB0, PERIODIC, A);
+    Task_Create_Basic(job, PB1, PERIODIC, B);
+    Task_Create_RR(spawner, 0);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file   test026.cpp
+ * @date   Sun Oct 18 2026
+ *
+ * @brief  Test 026 - coroutines waiting on I/O instead of blocking a task each
+ *
+ * An RR task plays a byte-at-a-time client (like PSTask's _client->available()
+ * and read()), offering bytes 0, 1, 2, ... one per turn. A parser coroutine
+ * reads them in packets of PACKET bytes with CO_WAIT_UNTIL() and toggles pin 7
+ * for each whole packet. WATCHERS more coroutines each wait for their own
+ * packet count and end, toggling pin 6. When the parser has seen PACKETS
+ * packets it ends too; the trace holds the packet count and the number of
+ * watchers that finished, which should be PACKETS and WATCHERS.
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#define PACKET   4
+#define PACKETS  50
+#define WATCHERS 24
+
+enum { A=1, B, C, D, E, F, G };
+const unsigned char PPP[] = {};
+const unsigned int PT = 0;
+
+uint8_t volatile rx_byte;
+uint8_t volatile rx_full = 0;
+uint8_t volatile packets = 0;
+uint8_t volatile watchers_done = 0;
+
+typedef struct
+{
+    COROUTINE co;
+    uint8_t   got;
+    uint8_t   expected;
+    uint8_t   errors;
+} parser_t;
+
+parser_t parser;
+COROUTINE watchers[WATCHERS];
+
+int8_t parse(COROUTINE *co)
+{
+    parser_t *p = (parser_t *)co;
+
+    CO_BEGIN(co);
+    p->expected = 0;
+    while(packets < PACKETS)
+    {
+        for(p->got = 0; p->got < PACKET; p->got++)
+        {
+            CO_WAIT_UNTIL(co, rx_full);
+            if(rx_byte != p->expected++)
+            {
+                p->errors++;
+            }
+            rx_full = 0;
+        }
+        packets++;
+        PORTB ^= _BV(PB7);
+    }
+    CO_END(co);
+}
+
+int8_t watch(COROUTINE *co)
+{
+    CO_BEGIN(co);
+    CO_WAIT_UNTIL(co, packets > co->arg);
+    PORTB ^= _BV(PB6);
+    watchers_done++;
+    CO_END(co);
+}
+
+void client(void)
+{
+    uint8_t next = 0;
+
+    while(packets < PACKETS || watchers_done < WATCHERS)
+    {
+        if(!rx_full && packets < PACKETS)
+        {
+            rx_byte = next++;
+            rx_full = 1;
+        }
+        Task_Next();
+    }
+
+    add_to_trace(packets);
+    add_to_trace(watchers_done);
+    add_to_trace(parser.errors);
+    print_trace();
+}
+
+int r_main(void)
+{
+    uint8_t i;
+
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(26);
+
+    DDRB = _BV(PB7) | _BV(PB6);
+    PORTB = 0;
+
+    Coroutine_Start(&parser.co, parse, 0);
+    for(i = 0; i < WATCHERS; i++)
+    {
+        Coroutine_Start(&watchers[i], watch, i * PACKETS / WATCHERS);
+    }
+    Task_Create_RR(client, 0);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file   test027.cpp
+ * @date   Sun Oct 18 2026
+ *
+ * @brief  Test 027 - a non-blocking block pool shared with an ISR
+ *
+ * A pool of BLOCKS packets is declared with POOL_DEFINE(). An RR task takes
+ * every block with Pool_TryAlloc(), checks that one more is refused, marks
+ * each block in use, and frees them all again, ROUNDS times. A timer 3
+ * interrupt takes and frees one block whenever one is free, so it may win
+ * a block the task wanted but must never get one that is in use. The trace
+ * holds the rounds run, the high water mark, which should be BLOCKS, and
+ * the number of errors, which should be 0.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "common.h"
+#include "os.h"
+#include "uart/uart.h"
+#include "trace/trace.h"
+
+#define BLOCKS 4
+#define ROUNDS 50
+
+enum { A=1, B, C, D, E, F, G };
+const unsigned char PPP[] = {};
+const unsigned int PT = 0;
+
+/* A free block's first bytes hold the free list link, so the flag goes last. */
+typedef struct
+{
+    uint8_t data[9];
+    uint8_t in_use;
+} packet_t;
+
+POOL_DEFINE(packets, sizeof(packet_t), BLOCKS);
+
+uint8_t volatile errors = 0;
+
+void allocator(void)
+{
+    packet_t* held[BLOCKS];
+    uint8_t rounds;
+    uint8_t n;
+
+    for(rounds = 0; rounds < ROUNDS; rounds++)
+    {
+        for(n = 0; n < BLOCKS; n++)
+        {
+            /* The ISR gives back whatever it takes before it returns. */
+            while((held[n] = (packet_t*)Pool_TryAlloc(&packets)) == NULL)
+            {
+                Task_Next();
+            }
+            if(held[n]->in_use)
+            {
+                errors++;
+            }
+            held[n]->in_use = 1;
+        }
+
+        if(Pool_TryAlloc(&packets) != NULL)
+        {
+            errors++;
+        }
+
+        while(n > 0)
+        {
+            held[--n]->in_use = 0;
+            Pool_Free(&packets, held[n]);
+        }
+        PORTB ^= _BV(PB7);
+        Task_Next();
+    }
+
+    TIMSK3 &= ~_BV(OCIE3A);
+    add_to_trace(rounds);
+    add_to_trace(Pool_HighWater(&packets));
+    add_to_trace(errors);
+    print_trace();
+}
+
+int r_main(void)
+{
+    uart_init();
+    uart_write((uint8_t*)"\r\nSTART\r\n", 9);
+    set_test(27);
+
+    DDRB = _BV(PB7);
+    PORTB = 0;
+
+    Pool_Init(&packets);
+    Task_Create_RR(allocator, 0);
+
+    /* Run clock at 2MHz, CTC every 256 counts. */
+    TCCR3A = 0;
+    TCCR3B = _BV(WGM32) | _BV(CS31);
+    OCR3A = 255;
+    TIFR3 = _BV(OCF3A);
+    TIMSK3 |= _BV(OCIE3A);
+
+    return 0;
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+    packet_t* p = (packet_t*)Pool_TryAlloc(&packets);
+
+    if(p != NULL)
+    {
+        if(p->in_use)
+        {
+            errors++;
+        }
+        Pool_Free(&packets, p);
+    }
+}
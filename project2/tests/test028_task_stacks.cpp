@@ -0,0 +1,48 @@
+/**
+ * @file   test028.cpp
+ * @date   Sun Oct 18 2026
+ *
+ * @brief  Test 028 - per-task stack sizes carved from the stack arena
+ *
+ * Build with -DSTACK_ARENA=1024. Task_Create_Stack() creates 5 RR tasks with
+ * SMALL_STACK byte stacks, more than the 2 that would fit with WORKSPACE
+ * stacks, each toggling its own pin of port B when it runs. Pin 7 goes high
+ * once the next SMALL_STACK byte task is refused because the arena is full,
+ * while task descriptors are still free.
+ */
+
+#include <avr/io.h>
+#include "common.h"
+#include "os.h"
+
+#define SMALL_STACK 128
+#define FULL_PIN 7 /* digital pin 13 */
+
+void toggler(void)
+{
+    for(;;)
+    {
+        PORTB ^= _BV(Task_GetArg());
+        Task_Next();
+    }
+}
+
+int r_main(void)
+{
+    uint8_t i;
+
+    DDRB = 0xFF;
+    PORTB = 0;
+
+    /* Idle takes MINSTACK and r_main WORKSPACE, leaving 704 bytes, room for 5 small stacks. */
+    for(i = 0; i < 5; i++)
+    {
+        Task_Create_Stack(toggler, i, RR, 0, SMALL_STACK);
+    }
+
+    if(Task_Create_Stack(toggler, 0, RR, 0, SMALL_STACK) == 0)
+    {
+        PORTB |= _BV(FULL_PIN);
+    }
+    return 0;
+}
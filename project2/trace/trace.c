@@ -0,0 +1,135 @@
+/**
+ * @file   trace.c
+ *
+ * @brief The kernel event ring, its drain task, and the test value trace.
+ *
+ * CSC 460/560 Real Time Operating Systems - Mantis Cheng
+ */
+#include <avr/interrupt.h>
+#include "trace.h"
+#include "os.h"
+#include "uart/uart.h"
+
+#if TRACE_RING_SIZE & (TRACE_RING_SIZE - 1) || TRACE_RING_SIZE > 128
+#error "TRACE_RING_SIZE must be a power of two, at most 128"
+#endif
+
+trace_record_t trace_ring[TRACE_RING_SIZE];
+volatile uint8_t trace_head = 0;
+volatile uint8_t trace_tail = 0;
+volatile uint8_t trace_lost = 0;
+
+/** Number given to set_test(). */
+static uint8_t test_number = 0;
+
+/** Values kept by add_to_trace(). */
+static uint16_t values[TRACE_VALUES];
+
+/** Number of values kept. */
+static uint8_t values_len = 0;
+
+
+/**
+ * @brief Send one record framed as TRACE_SYNC, type, arg, time low, time high, xor.
+ */
+static void trace_send(uint8_t type, uint8_t arg, uint16_t time)
+{
+	uint8_t lo = (uint8_t)time;
+	uint8_t hi = (uint8_t)(time >> 8);
+
+	uart_putchar(TRACE_SYNC);
+	uart_putchar(type);
+	uart_putchar(arg);
+	uart_putchar(lo);
+	uart_putchar(hi);
+	uart_putchar(type ^ arg ^ lo ^ hi);
+}
+
+
+/**
+ * The task spins while the ring is empty instead of calling Task_Next(),
+ * which would log a system call and a switch for every empty poll. At the
+ * lowest RR priority the spinning only uses time that would be idle anyway.
+ */
+void trace_drain(void)
+{
+	trace_record_t r;
+	uint8_t sreg;
+
+	trace_send(TRACE_START, MAXPROCESS, TCNT1);
+
+	for(;;)
+	{
+		while(trace_tail == trace_head)
+		{
+		}
+
+		sreg = SREG;
+		cli();
+		r = trace_ring[trace_tail];
+		trace_tail = (trace_tail + 1) & (TRACE_RING_SIZE - 1);
+		SREG = sreg;
+
+		trace_send(r.type, r.arg, r.time);
+	}
+}
+
+
+void set_test(uint8_t test)
+{
+	test_number = test;
+}
+
+
+void add_to_trace(uint16_t value)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if(values_len < TRACE_VALUES)
+	{
+		values[values_len++] = value;
+	}
+	SREG = sreg;
+}
+
+
+/**
+ * @brief Send a value in decimal.
+ */
+static void print_number(uint16_t n)
+{
+	uint8_t digits[5];
+	uint8_t len = 0;
+
+	do
+	{
+		digits[len++] = '0' + n % 10;
+		n /= 10;
+	}
+	while(n != 0);
+
+	while(len--)
+	{
+		uart_putchar(digits[len]);
+	}
+}
+
+
+void print_trace(void)
+{
+	uint8_t i;
+
+	uart_putchar('T');
+	print_number(test_number);
+	uart_putchar(':');
+
+	for(i = 0; i < values_len; ++i)
+	{
+		uart_putchar(' ');
+		print_number(values[i]);
+	}
+
+	uart_write((uint8_t*)"\r\n", 2);
+}
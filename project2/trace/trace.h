@@ -0,0 +1,167 @@
+/**
+ * @file   trace.h
+ *
+ * @brief Kernel event tracing, and the value trace used by the tests.
+ *
+ * Kernel events: when the kernel is built with -DKERNEL_TRACE it calls
+ * trace_event() on every context switch, timer tick, system call, task
+ * creation and PPP slot change. Each event is a 4 byte record carrying its
+ * TCNT1 timestamp (F_CPU / TIMER_PRESCALER, 2 MHz at 16 MHz) and goes into a
+ * static ring of TRACE_RING_SIZE records. The application drains the ring to
+ * USART0 by creating trace_drain() as an RR task:
+ *
+ *   uart_init();
+ *   Task_Create_RR_Priority(trace_drain, 0, PRIORITY_LEVELS - 1);
+ *
+ * On the wire every record is framed as TRACE_SYNC, type, arg, timestamp
+ * low, timestamp high, and the xor of those four bytes. trace/trace_decode.cpp
+ * turns a capture of the stream into a per-task timeline, a utilization
+ * report and Chrome/Perfetto trace JSON.
+ *
+ * TCNT1 wraps every 32 ms at 2 MHz. The decoder unwraps it, which works as
+ * long as no two consecutive records are a whole wrap apart; the TICK record
+ * every 5 ms sees to that. If the ring fills up, new events are dropped and
+ * counted, and a TRACE_LOST record with the count is logged once there is room.
+ *
+ * Link trace/trace.c and uart/uart.c with the application (add them to PRJSRC).
+ *
+ * Test values: add_to_trace() keeps up to TRACE_VALUES 16-bit values and
+ * print_trace() sends them as text, preceded by the number given to set_test().
+ *
+ * CSC 460/560 Real Time Operating Systems - Mantis Cheng
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <avr/io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Records in the kernel event ring, a power of two at most 128. */
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE     64
+#endif
+
+/** Values kept by add_to_trace(). */
+#ifndef TRACE_VALUES
+#define TRACE_VALUES        32
+#endif
+
+/** First byte of every record on the wire. */
+#define TRACE_SYNC          0x7E
+
+/**
+ * @brief The kernel events. The meaning of a record's arg depends on its type.
+ */
+typedef enum
+{
+    /** Sent by trace_drain() before the first record. arg is MAXPROCESS, the idle task's index. */
+    TRACE_START = 1,
+    /** A task was given the processor. arg is its descriptor index. */
+    TRACE_SWITCH,
+    /** The timer tick interrupt entered the kernel. arg is the interrupted task's index. */
+    TRACE_TICK,
+    /** The running task made a system call. arg is its kernel request code. */
+    TRACE_SYSCALL,
+    /** A value was published to a service. arg is the service's index. */
+    TRACE_PUBLISH,
+    /** A new PPP slot began. arg is its name, IDLE for an idle slot. */
+    TRACE_SLOT,
+    /** A task was created. arg is its level in the high nibble, its index in the low nibble. */
+    TRACE_CREATE,
+    /** A task terminated. arg is its index. */
+    TRACE_EXIT,
+    /** Events were dropped because the ring was full. arg is how many, at most 255. */
+    TRACE_LOST
+}
+trace_type_t;
+
+/**
+ * @brief One kernel event.
+ */
+typedef struct
+{
+    /** A trace_type_t. */
+    uint8_t type;
+    /** Depends on type. */
+    uint8_t arg;
+    /** TCNT1 when the event happened. */
+    uint16_t time;
+}
+trace_record_t;
+
+/** The ring. Written by the kernel with interrupts disabled, read by trace_drain(). */
+extern trace_record_t trace_ring[TRACE_RING_SIZE];
+
+/** Index of the next record to write. */
+extern volatile uint8_t trace_head;
+
+/** Index of the next record to drain. */
+extern volatile uint8_t trace_tail;
+
+/** Events dropped since the last TRACE_LOST record. */
+extern volatile uint8_t trace_lost;
+
+/**
+ * @brief Log a kernel event. Must be called with interrupts disabled.
+ */
+static inline void trace_event(uint8_t type, uint8_t arg)
+{
+    uint8_t head = trace_head;
+    uint8_t free = (uint8_t)(trace_tail - head - 1) & (TRACE_RING_SIZE - 1);
+
+    if(trace_lost != 0)
+    {
+        if(free < 2)
+        {
+            if(trace_lost != 0xFF)
+            {
+                ++trace_lost;
+            }
+            return;
+        }
+        trace_ring[head].type = TRACE_LOST;
+        trace_ring[head].arg = trace_lost;
+        trace_ring[head].time = TCNT1;
+        head = (head + 1) & (TRACE_RING_SIZE - 1);
+        trace_lost = 0;
+    }
+    else if(free == 0)
+    {
+        trace_lost = 1;
+        return;
+    }
+
+    trace_ring[head].type = type;
+    trace_ring[head].arg = arg;
+    trace_ring[head].time = TCNT1;
+    trace_head = (head + 1) & (TRACE_RING_SIZE - 1);
+}
+
+/**
+ * @brief Task body that sends the ring over USART0 forever. Create it as a low priority RR task.
+ */
+void trace_drain(void);
+
+/**
+ * @brief Number the test whose values print_trace() will send.
+ */
+void set_test(uint8_t test);
+
+/**
+ * @brief Keep a value for print_trace(). Values beyond TRACE_VALUES are dropped.
+ */
+void add_to_trace(uint16_t value);
+
+/**
+ * @brief Send "T<test>:" and the kept values in decimal, one line, over USART0.
+ */
+void print_trace(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
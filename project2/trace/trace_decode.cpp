@@ -0,0 +1,366 @@
+/**
+ * @file   trace_decode.cpp
+ *
+ * @brief Host tool: decode a capture of the kernel trace stream (see trace.h).
+ *
+ * Build and run on the workstation, not the board:
+ *
+ *   g++ -std=c++11 -O2 -o trace_decode trace/trace_decode.cpp
+ *   trace_decode [-f timer_hz] [-t] [-j trace.json] capture.bin
+ *
+ * The capture is the raw bytes read from the serial port; text the tests print
+ * in between is skipped. The tool prints a utilization report per task and,
+ * with -t, the timeline of switches and events. With -j it writes Chrome trace
+ * JSON, which chrome://tracing and ui.perfetto.dev open directly. Timestamps are
+ * TCNT1 counts at timer_hz, by default 2000000 (16 MHz, prescaler 8).
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+/* Must match trace_type_t in trace.h. */
+enum
+{
+	TRACE_START = 1,
+	TRACE_SWITCH,
+	TRACE_TICK,
+	TRACE_SYSCALL,
+	TRACE_PUBLISH,
+	TRACE_SLOT,
+	TRACE_CREATE,
+	TRACE_EXIT,
+	TRACE_LOST
+};
+
+#define TRACE_SYNC      0x7E
+#define FRAME_LEN       6
+
+/* Must match kernel_request_t in kernel.h. */
+static const char* request_names[] =
+{
+	"NONE", "TIMER_EXPIRED", "TASK_CREATE", "TASK_TERMINATE", "TASK_NEXT", "TASK_GET_ARG"
+};
+
+/* Scheduling levels from os.h; index is the level. */
+static const char* level_names[] = { "idle", "RR", "PERIODIC", "SYSTEM" };
+
+/** A decoded record, with its time unwrapped. */
+struct record
+{
+	uint8_t type;
+	uint8_t arg;
+	uint64_t time;
+};
+
+/** What is known about one task descriptor. */
+struct task_stats
+{
+	std::string name;
+	uint64_t run_time = 0;
+	unsigned switches = 0;
+	unsigned ticks = 0;
+	unsigned syscalls = 0;
+};
+
+/** A stretch of time one task held the processor. */
+struct interval
+{
+	int task;
+	uint64_t start;
+	uint64_t end;
+};
+
+
+/**
+ * @brief Find the framed records in the capture and unwrap their TCNT1 times.
+ *
+ * @param noise set to the number of bytes that were not part of a record
+ */
+static std::vector<record> parse(const std::vector<uint8_t>& in, size_t& noise)
+{
+	std::vector<record> out;
+	uint64_t now = 0;
+	uint16_t last = 0;
+	bool first = true;
+	size_t i = 0;
+
+	noise = 0;
+	while(i < in.size())
+	{
+		if(in[i] != TRACE_SYNC || i + FRAME_LEN > in.size() ||
+			in[i + 1] < TRACE_START || in[i + 1] > TRACE_LOST ||
+			(in[i + 1] ^ in[i + 2] ^ in[i + 3] ^ in[i + 4]) != in[i + 5])
+		{
+			++noise;
+			++i;
+			continue;
+		}
+
+		uint16_t t = (uint16_t)(in[i + 3] | (in[i + 4] << 8));
+		if(!first)
+		{
+			/* Records are less than one TCNT1 wrap apart. */
+			now += (uint16_t)(t - last);
+		}
+		first = false;
+		last = t;
+
+		out.push_back(record{ in[i + 1], in[i + 2], now });
+		i += FRAME_LEN;
+	}
+
+	return out;
+}
+
+
+static double to_us(uint64_t t, double hz)
+{
+	return t * 1e6 / hz;
+}
+
+
+static task_stats& task(std::map<int, task_stats>& tasks, int index, int idle)
+{
+	task_stats& s = tasks[index];
+	if(s.name.empty())
+	{
+		s.name = index == idle ? "idle" : "task " + std::to_string(index);
+	}
+	return s;
+}
+
+
+int main(int argc, char** argv)
+{
+	double hz = 2000000.0;
+	const char* json_path = NULL;
+	const char* in_path = NULL;
+	bool timeline = false;
+
+	for(int a = 1; a < argc; ++a)
+	{
+		if(!strcmp(argv[a], "-f") && a + 1 < argc)
+		{
+			hz = atof(argv[++a]);
+		}
+		else if(!strcmp(argv[a], "-j") && a + 1 < argc)
+		{
+			json_path = argv[++a];
+		}
+		else if(!strcmp(argv[a], "-t"))
+		{
+			timeline = true;
+		}
+		else if(argv[a][0] != '-' && in_path == NULL)
+		{
+			in_path = argv[a];
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-f timer_hz] [-t] [-j trace.json] capture.bin\n", argv[0]);
+			return 2;
+		}
+	}
+
+	FILE* f = in_path ? fopen(in_path, "rb") : stdin;
+	if(f == NULL)
+	{
+		perror(in_path);
+		return 1;
+	}
+	std::vector<uint8_t> bytes;
+	int c;
+	while((c = fgetc(f)) != EOF)
+	{
+		bytes.push_back((uint8_t)c);
+	}
+	if(f != stdin)
+	{
+		fclose(f);
+	}
+
+	size_t noise;
+	std::vector<record> recs = parse(bytes, noise);
+	if(recs.empty())
+	{
+		fprintf(stderr, "no trace records found\n");
+		return 1;
+	}
+
+	std::map<int, task_stats> tasks;
+	std::vector<interval> runs;
+	std::vector<interval> slots;
+	unsigned lost = 0;
+	int idle = -1;
+	int running = -1;
+	uint64_t since = recs.front().time;
+	uint64_t slot_since = 0;
+	int slot = -1;
+
+	for(const record& r : recs)
+	{
+		if(timeline)
+		{
+			printf("%12.1f us  ", to_us(r.time - recs.front().time, hz));
+		}
+
+		switch(r.type)
+		{
+			case TRACE_START:
+				/* The board (re)started; nothing is known to be running. */
+				idle = r.arg;
+				running = -1;
+				slot = -1;
+				if(timeline) printf("start, idle task is %d\n", idle);
+				break;
+
+			case TRACE_SWITCH:
+				if(running >= 0)
+				{
+					runs.push_back(interval{ running, since, r.time });
+					task(tasks, running, idle).run_time += r.time - since;
+				}
+				running = r.arg;
+				since = r.time;
+				++task(tasks, running, idle).switches;
+				if(timeline) printf("switch to %s\n", task(tasks, running, idle).name.c_str());
+				break;
+
+			case TRACE_TICK:
+				++task(tasks, r.arg, idle).ticks;
+				if(timeline) printf("tick in %s\n", task(tasks, r.arg, idle).name.c_str());
+				break;
+
+			case TRACE_SYSCALL:
+				if(running >= 0)
+				{
+					++task(tasks, running, idle).syscalls;
+				}
+				if(timeline)
+				{
+					printf("syscall %s\n", r.arg < sizeof(request_names) / sizeof(*request_names)
+						? request_names[r.arg] : "?");
+				}
+				break;
+
+			case TRACE_PUBLISH:
+				if(timeline) printf("publish to service %d\n", r.arg);
+				break;
+
+			case TRACE_SLOT:
+				if(slot >= 0)
+				{
+					slots.push_back(interval{ slot, slot_since, r.time });
+				}
+				slot = r.arg;
+				slot_since = r.time;
+				if(timeline) printf("PPP slot %d\n", slot);
+				break;
+
+			case TRACE_CREATE:
+			{
+				int index = r.arg & 0x0F;
+				int level = r.arg >> 4;
+				task_stats& s = task(tasks, index, idle);
+				s.name = index == idle ? "idle" : "task " + std::to_string(index) + " (" + level_names[level & 3] + ")";
+				if(timeline) printf("create %s\n", s.name.c_str());
+				break;
+			}
+
+			case TRACE_EXIT:
+				if(timeline) printf("exit %s\n", task(tasks, r.arg, idle).name.c_str());
+				break;
+
+			case TRACE_LOST:
+				lost += r.arg;
+				if(timeline) printf("%d events lost\n", r.arg);
+				break;
+		}
+	}
+
+	uint64_t end = recs.back().time;
+	if(running >= 0)
+	{
+		runs.push_back(interval{ running, since, end });
+		task(tasks, running, idle).run_time += end - since;
+	}
+	if(slot >= 0)
+	{
+		slots.push_back(interval{ slot, slot_since, end });
+	}
+
+	uint64_t span = end - recs.front().time;
+	printf("%zu records over %.1f ms, %u events lost, %zu bytes skipped\n",
+		recs.size(), to_us(span, hz) / 1000.0, lost, noise);
+	printf("%-24s %12s %7s %9s %7s %9s\n", "task", "run us", "cpu %", "switches", "ticks", "syscalls");
+	for(auto& kv : tasks)
+	{
+		const task_stats& s = kv.second;
+		printf("%-24s %12.1f %6.1f%% %9u %7u %9u\n", s.name.c_str(), to_us(s.run_time, hz),
+			span ? 100.0 * s.run_time / span : 0.0, s.switches, s.ticks, s.syscalls);
+	}
+
+	if(json_path != NULL)
+	{
+		FILE* j = fopen(json_path, "w");
+		if(j == NULL)
+		{
+			perror(json_path);
+			return 1;
+		}
+
+		uint64_t t0 = recs.front().time;
+		fprintf(j, "{\"traceEvents\":[\n");
+		fprintf(j, "{\"ph\":\"M\",\"pid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"project2\"}}");
+		for(auto& kv : tasks)
+		{
+			fprintf(j, ",\n{\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+				kv.first, kv.second.name.c_str());
+		}
+		fprintf(j, ",\n{\"ph\":\"M\",\"pid\":0,\"tid\":100,\"name\":\"thread_name\",\"args\":{\"name\":\"PPP slots\"}}");
+		for(const interval& r : runs)
+		{
+			fprintf(j, ",\n{\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+				r.task, tasks[r.task].name.c_str(), to_us(r.start - t0, hz), to_us(r.end - r.start, hz));
+		}
+		for(const interval& s : slots)
+		{
+			fprintf(j, ",\n{\"ph\":\"X\",\"pid\":0,\"tid\":100,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+				s.task == 0 ? "IDLE" : ("slot " + std::to_string(s.task)).c_str(),
+				to_us(s.start - t0, hz), to_us(s.end - s.start, hz));
+		}
+
+		running = -1;
+		for(const record& r : recs)
+		{
+			const char* name = NULL;
+			int tid = running;
+			switch(r.type)
+			{
+				case TRACE_START: running = -1; break;
+				case TRACE_SWITCH: running = r.arg; break;
+				case TRACE_TICK: name = "tick"; tid = r.arg; break;
+				case TRACE_SYSCALL:
+					name = r.arg < sizeof(request_names) / sizeof(*request_names) ? request_names[r.arg] : "syscall";
+					break;
+				case TRACE_PUBLISH: name = "publish"; break;
+				case TRACE_CREATE: name = "create"; break;
+				case TRACE_EXIT: name = "exit"; tid = r.arg; break;
+				case TRACE_LOST: name = "lost"; break;
+			}
+			if(name != NULL)
+			{
+				fprintf(j, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%d,\"name\":\"%s\",\"ts\":%.3f,\"args\":{\"arg\":%d}}",
+					tid < 0 ? 100 : tid, name, to_us(r.time - t0, hz), r.arg);
+			}
+		}
+		fprintf(j, "\n]}\n");
+		fclose(j);
+	}
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file   uart.c
+ *
+ * @brief Polled transmit on USART0.
+ *
+ * Nothing here is interrupt driven, so it is safe to call from any task;
+ * a task sending a long buffer simply keeps the processor while it waits.
+ */
+#include "uart.h"
+
+void uart_init(void)
+{
+	/* Double speed mode halves the baud rate error at 16 MHz. */
+	UCSR0A = _BV(U2X0);
+	UBRR0 = (uint16_t)((F_CPU / (8UL * UART_BAUD)) - 1);
+	
+	/* 8 data bits, no parity, 1 stop bit. */
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+	UCSR0B = _BV(TXEN0);
+}
+
+void uart_putchar(uint8_t c)
+{
+	while(!(UCSR0A & _BV(UDRE0)))
+	{
+	}
+	UDR0 = c;
+}
+
+void uart_write(uint8_t* buf, uint8_t len)
+{
+	while(len--)
+	{
+		uart_putchar(*buf++);
+	}
+}
@@ -0,0 +1,41 @@
+/**
+ * @file   uart.h
+ *
+ * @brief Polled transmit on USART0, used by the tests and the trace drain.
+ *
+ * CSC 460/560 Real Time Operating Systems - Mantis Cheng
+ */
+#ifndef __UART_H__
+#define __UART_H__
+
+#include <avr/io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Baud rate of USART0. */
+#ifndef UART_BAUD
+#define UART_BAUD       57600UL
+#endif
+
+/**
+ * @brief Set up USART0 for 8N1 at UART_BAUD, transmit only.
+ */
+void uart_init(void);
+
+/**
+ * @brief Send one byte, busy waiting until the transmit buffer is free.
+ */
+void uart_putchar(uint8_t c);
+
+/**
+ * @brief Send len bytes from buf, busy waiting on each.
+ */
+void uart_write(uint8_t* buf, uint8_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif